@@ -11,10 +11,16 @@
 #include <vector>
 #include <thread>
 #include "Logger.h"
+#include "Trace.h"
+#include "Metrics.h"
 #include <mutex>
+#include <condition_variable>
 #include "PasswdMgr.h"
 #include <map>
 #include <queue>
+#include <deque>
+#include <chrono>
+#include <random>
 
 /* Structure to hold attributes of a client object */
 struct Client {
@@ -23,6 +29,57 @@ struct Client {
 	std::string ipAddress;
 };
 
+/* Structure to hold what a slave node announced about itself in its REGISTER message */
+struct SlaveNode {
+	int conn;
+	bool registered = false; // false until the slave's REGISTER message arrives
+	int cores = 1; // how many jobs the slave node runs at once
+	int maxBits = 0; // widest integer width (in bits) the slave can factor
+	std::vector<std::string> algorithms; // e.g. rho, ecm, fast64
+	double benchmarkScore = 0; // higher is faster
+
+	// health tracking, filled in by the health monitor daemon and as messages arrive
+	std::chrono::steady_clock::time_point lastSeen = std::chrono::steady_clock::now(); // last time we heard anything from the slave
+	long heartbeatsAnswered = 0;
+	long jobsCompleted = 0;
+	double rttEwmaMs = 0; // heartbeat round trip time
+	long slowdownSamples = 0;
+	double slowdownEwma = 0; // job time over the typical time for numbers of that size (1 = typical)
+	bool slow = false; // heartbeat round trip is above slowSlaveRttMs, or jobs take over slowSlaveSlowdown times as long as usual
+
+	// utilization, for the metrics endpoint
+	std::chrono::steady_clock::time_point connectedAt = std::chrono::steady_clock::now();
+	double busySeconds = 0; // time spent on jobs it finished
+};
+
+/* Structure to hold a job: one attempt at factoring a client's number on one slave node */
+struct Job {
+	int slaveNodeId = -1; // -1 until a slave node is assigned
+	unsigned long jobId = 0; // identifies this copy to its slave node, which may be running several jobs at once
+	int clientId;
+	int requestId; // the main server's id for this request; (clientId, requestId) identifies the request
+	std::string numberToFactorize;
+	int bits = 0; // bit length of numberToFactorize, worked out once when the job is made
+	bool done = false;
+	bool cancelled = false;
+	unsigned long seed; // seeds the slave node's random walk so copies of a job don't repeat each other's work
+	bool backupLaunched = false; // a speculative copy of this job has been queued because it is straggling
+	std::chrono::steady_clock::time_point createdTime = std::chrono::steady_clock::now(); // when the job was queued
+	std::chrono::steady_clock::time_point startTime; // when the job was sent to its slave node
+
+	// optional budget from the client: answer with whatever has been found by the deadline (or
+	// after budgetIterations rho iterations), leaving the rest unfactored. Copies keep the deadline
+	unsigned long budgetMs = 0; // 0 for no time limit
+	unsigned long budgetIterations = 0; // 0 for no iteration limit
+	std::chrono::steady_clock::time_point deadline; // createdTime + budgetMs of the request's first job
+
+	// latest CHECKPOINT from the slave node, handed to whichever slave node takes the job over
+	bool hasCheckpoint = false;
+	std::string checkpointPrimes; // prime1,...,primeN found so far
+	std::string checkpointCofactors; // cofactor1,...,cofactorN still to be factored
+	std::string checkpointWalk; // n:x:y:c of the rho walk in progress
+};
+
 class TCPServer : public Server 
 {
 public:
@@ -37,22 +94,35 @@ public:
    void listenSvr();
    void shutdown();
    bool checkIfIPWhiteListed(std::string ipAddr);
-   void sendMessage(int conn, std::string msg);
-   std::string receiveMessage(int conn);
+   bool sendMessage(int conn, std::string msg);
+   bool sendMessages(int conn, const std::vector<std::string>& msgs);
+   bool receiveMessages(int conn, std::string& pending, std::vector<std::string>& messages);
+   void setHeartbeatTimeouts(int intervalMs, int timeoutMs, int slowRttMs);
+   void setLogFile(std::string fileName) { logger.setLogFileName(fileName); };
+   bool startMetrics(const char *ip_addr, unsigned short port);
    void handleMessage(std::string msg, int conn);
 
 private:
  int sockfd = -1;
  std::vector<int> slaveConns; // vector to hold slave connection id's
+ std::map<int, SlaveNode> slaveNodes; // capabilities of each slave node, keyed by connection id
+ std::mutex slavesMutex; // lock for slaveConns and slaveNodes
  std::vector<int> deadSlaveConns; // vector to hold slave conn's that die; when death detected, conn id added here.
  // once all outbound jobs to this conn are reset, conn id removed from this vector.
 
- // (slaveNodeId, clientId, numberToFactorize, done, cancelled)) 
- std::vector<std::tuple<int, int, std::string, bool, bool>> jobs; // current jobs assigned to slave nodes
- std::mutex jobsMutex; 
+ std::vector<Job> jobs; // current jobs assigned to slave nodes
+ std::mutex jobsMutex; // lock for jobs and completionTimes
+
+ // completion times (seconds) of recent jobs, keyed by bit length rounded up to bitLengthBucketSize
+ std::map<int, std::deque<double>> completionTimes;
+ std::mt19937_64 seedGenerator{std::random_device{}()}; // seeds handed out with each job
+ unsigned long nextJobId = 1; // job ids handed out with each job
 
- // (clientId, numberToFactorize, prime factors of numberToFactorize)
- std::queue<std::tuple<std::string, std::string, std::string>> completedJobs; // queue of all jobs that completed and need to be sent to main server
+ // (clientId, requestId, numberToFactorize, prime factors of numberToFactorize, cofactors left unfactored when the budget ran out,
+ // why the request couldn't be factored at all, if it couldn't)
+ std::queue<std::tuple<int, int, std::string, std::string, std::string, std::string>> completedJobs; // queue of all jobs that completed and need to be sent to main server
+ std::mutex completedJobsMutex; // lock for completedJobs
+ std::condition_variable completedJobsCv; // wakes cjd when a job completes
 
  sockaddr_in sockaddr;
  Logger logger;
@@ -62,23 +132,64 @@ private:
  int mainServerConnId = -1; // connection ID to main server
  bool mainServerAlive = false;
 
- int numberOfJobsPerClientReq = 5; // number of jobs for each client request (TODO: need to change this to be based on the number of slave nodes!!!)
+ // speculative re-execution: a job running longer than speculationPercentile of recent jobs of
+ // its size gets a copy started on an idle slave node with a different seed; whichever finishes
+ // first wins and the other is cancelled
+ int maxJobsPerClientReq = 3; // most copies of one client request in flight at once
+ double speculationPercentile = 0.9;
+ int minSamplesForSpeculation = 10; // below this many completions for a size, speculateAfterMs is used instead
+ int speculateAfterMs = 2000;
+ int minSpeculationMs = 250; // never launch copies of jobs younger than this
+ int bitLengthBucketSize = 8;
+ unsigned int completionSamplesPerBucket = 100;
+ int largeNumberBits = 64; // numbers at least this wide go to the fastest capable slave, smaller ones to the slowest
+
+ int heartbeatIntervalMs = 1000; // how often we send each slave node a HEARTBEAT
+ int heartbeatTimeoutMs = 5000; // slave nodes silent for longer than this are treated as dead
+ int slowSlaveRttMs = 2000; // slave nodes whose heartbeat round trip averages above this have their job reassigned
+ double slowSlaveSlowdown = 4.0; // as are slave nodes whose jobs average this many times the typical time for their size
+ double ewmaAlpha = 0.2; // weight of the newest sample in the per-slave moving averages
+
+ // metrics; queue depths and slave node utilization are computed when the endpoint is read
+ Counter& requestsReceived = Metrics::get().counter("coordinator_requests_received_total", "FACTOR_REQs received from the main server");
+ Counter& responsesSent = Metrics::get().counter("coordinator_responses_sent_total", "FACTOR_RESPs sent to the main server");
+ Counter& jobsDispatched = Metrics::get().counter("coordinator_jobs_dispatched_total", "POLLARD_REQs sent to slave nodes, copies included");
+ Counter& jobsCancelled = Metrics::get().counter("coordinator_jobs_cancelled_total", "copies of jobs cancelled because another copy answered first");
+ Counter& partialResults = Metrics::get().counter("coordinator_partial_results_total", "requests answered with unfactored cofactors because their budget ran out");
+ Histogram& dispatchLatency = Metrics::get().histogram("coordinator_dispatch_latency_us", "time from a job being queued to its POLLARD_REQ being sent");
+ Histogram& jobLatency = Metrics::get().histogram("coordinator_job_latency_us", "time from POLLARD_REQ to the POLLARD_RESP that answered the request");
+ void collectMetrics(std::string& out);
 
- std::mutex m1; // lock for logger
- void log(const char *msg);
- void log(std::string msg);
 
  // daemon services
  void jmd(); // job management daemon
  void cjd(); // completed jobs daemon
+ void hmd(); // health monitor daemon
 
  // utility functions
- std::vector<int> getAvailableSlaveNodeIds(); // returns slave node id's not currently assigned a job
+ std::vector<int> getAvailableSlaveNodeIds(); // returns slave node id's with fewer jobs assigned than they have cores. Call with jobsMutex held
+ std::map<int, int> getFreeSlots(); // slave node id -> how many more jobs it can take. Call with jobsMutex held
+ int pickSlaveNode(const std::vector<int>& availableSlaveNodeIds, int bits); // returns best slave node for a number, or -1 if none capable
+ void registerSlaveNode(int connId, const std::vector<std::string>& splitMessage); // records capabilities from a REGISTER message
+ int getBitLength(const std::string& number); // number of bits needed to hold a decimal number
+ bool isTooWideForSlaveNodes(int bits); // true if no connected slave node can hold a number this wide
 
  void markSlaveConnAsDead(int connId); // when we lose connection with a slave node, call this method
- bool checkIfJobCancelled(int inSlaveNodeId); // checks whether a job assigned to a slave node is cannceled 
- void setJobToDone(int inSlaveNodeId); // sets a job with slaveNodeId to done
- std::vector<int> setJobsToCancelled(int inSlaveNodeId, int inClientId, std::string inNumberToFactorize); // for any job that is not inSlaveNodeId, if it has the same (clientId, numberToFactorize) as inSlaveNodeId, set job to cancelled
+ bool checkIfSlaveConnDead(int connId); // true until jmd has reset every job of a dead slave node
+ void touchSlaveNode(int connId); // records that we just heard from a slave node
+ void recordHeartbeatResponse(int connId, const std::string& sentTimeMs); // updates round trip average from a HEARTBEAT_RESP
+ void recordJobCompletion(int connId, double seconds, double typicalSeconds); // updates slowdown average from a POLLARD_RESP
+ void reassignSlaveNodeJobs(int connId); // cancels a slave node's jobs and queues copies for other slave nodes
+ double ewma(double average, double sample, long samples);
+ Job makeJob(int clientId, int requestId, const std::string& numberToFactorize); // new unassigned job with a fresh seed
+ Job makeJob(const Job& original, bool resumeWalk); // new unassigned copy of a job that carries on from its checkpoint
+ void recordCheckpoint(const std::vector<std::string>& splitMessage); // stores a CHECKPOINT on its job
+ Job* findJob(int inSlaveNodeId, unsigned long inJobId); // job with this id on a slave node, or nullptr. Call with jobsMutex held
+ void recordCompletionTime(int bits, double seconds); // call with jobsMutex held
+ double getSpeculationThresholdMs(int bits); // call with jobsMutex held
+ double getTypicalSeconds(int bits); // call with jobsMutex held
+ void setJobToDone(int inSlaveNodeId, unsigned long inJobId); // sets the job with this id on slaveNodeId to done
+ std::vector<std::pair<int, unsigned long>> setJobsToCancelled(unsigned long inJobId, int inClientId, int inRequestId); // sets every other job for (clientId, requestId) to cancelled; returns the (slaveNodeId, jobId) of those running
 };
 
 
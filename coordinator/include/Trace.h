@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+/*
+ * Events recorded along a request's path. Each names the point reached, in the order a request
+ * normally reaches them.
+ */
+enum TraceEvent : uint16_t {
+	tr_request_received = 1, // main server: client sent a number (clientId, requestId)
+	tr_job_created,          // coordinator: FACTOR_REQ turned into a job (clientId, requestId, seed)
+	tr_job_dispatched,       // coordinator: POLLARD_REQ sent (clientId, requestId, seed, arg=slave node)
+	tr_slave_start,          // slave: started factoring (clientId, seed)
+	tr_divisor_found,        // slave: Pollard's rho split a cofactor (seed)
+	tr_slave_done,           // slave: POLLARD_RESP queued (clientId, seed)
+	tr_result_received,      // coordinator: first POLLARD_RESP for the request (clientId, requestId, seed)
+	tr_coord_response_sent,  // coordinator: FACTOR_RESP sent to the main server (clientId, requestId)
+	tr_response_sent,        // main server: answer sent to the client (clientId, requestId)
+	tr_event_count
+};
+
+// Which process recorded an event
+enum TraceComponent : uint16_t { tc_main_server = 1, tc_coordinator, tc_slave };
+
+/*
+ * One trace record as stored in the file: 32 bytes, host byte order. timeNs is CLOCK_MONOTONIC,
+ * which every process on a host shares, so traces from one host can be merged by time. Fields
+ * a process doesn't know are -1 (ids) or 0 (seed). Slaves don't know request ids; their events
+ * are tied to a request through the seed the coordinator dispatched with.
+ */
+struct TraceRecord {
+	uint64_t timeNs;
+	uint64_t seed;
+	int32_t clientId;
+	int32_t requestId;
+	uint16_t event;
+	uint16_t component;
+	int32_t arg;
+};
+
+static_assert(sizeof(TraceRecord) == 32, "trace records must stay 32 bytes");
+
+/*
+ * Trace - the process-wide binary event trace. Off until open() is called; record() is then a
+ * timestamp and an append to a buffer, and a background thread writes the buffer out every
+ * flushIntervalMs.
+ */
+class Trace {
+	public:
+		static Trace& get();
+		static uint64_t nowNs();
+
+		void open(const std::string& fileName, TraceComponent component);
+		bool enabled() { return isOpen; };
+		void record(TraceEvent event, int32_t clientId, int32_t requestId, uint64_t seed = 0, int32_t arg = 0);
+		void flush();
+
+	private:
+		Trace() {}
+		~Trace();
+
+		static const int flushIntervalMs = 100;
+
+		std::atomic<bool> isOpen{false};
+		std::atomic<bool> running{false};
+		uint16_t component = 0;
+		int traceFd = -1;
+
+		std::vector<TraceRecord> buffer; // records not yet written
+		std::mutex bufferMutex;
+		std::mutex writeMutex; // keeps flushes in order
+		std::thread writer;
+
+		void writerThread();
+};
+
+#endif
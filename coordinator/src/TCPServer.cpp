@@ -10,6 +10,9 @@
 #include <vector>
 #include <algorithm>
 #include <boost/algorithm/string.hpp>
+#include <boost/multiprecision/cpp_int.hpp>
+#include <cmath>
+#include "Decimal.h"
 #include <sstream>
 
 TCPServer::TCPServer() {
@@ -19,22 +22,6 @@ TCPServer::TCPServer() {
 TCPServer::~TCPServer() {
 }
 
-/*
- * Wrapper functions for logging. They use a lock to ensure threads do not attempt to write/read from
- * the log file at the same time.
- */
-void TCPServer::log(const char *msg) {
-	m1.lock();
-	logger.log(msg);
-	m1.unlock();
-}
-
-void TCPServer::log(std::string msg) {
-	m1.lock();
-	logger.log(msg);
-	m1.unlock();
-}
-
 /**********************************************************************************************
  * bindSvr - Creates a network socket and sets it nonblocking so we can loop through looking for
  *           data. Then binds it to the ip address and port
@@ -42,7 +29,7 @@ void TCPServer::log(std::string msg) {
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
-	log("Server starting up");
+	LOG(logger, INFO, "Server starting up");
 
 	// create socket
 	int sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -73,6 +60,21 @@ void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
 	jmdThread.detach();
 	std::thread cjdThread(&TCPServer::cjd, this);
 	cjdThread.detach();
+	std::thread hmdThread(&TCPServer::hmd, this);
+	hmdThread.detach();
+}
+
+/*
+ * setHeartbeatTimeouts - configures slave node health tracking.
+ *
+ *   Params: intervalMs - how often each slave node is sent a HEARTBEAT
+ *           timeoutMs - how long a slave node may stay silent before it is treated as dead
+ *           slowRttMs - heartbeat round trip average above which a slave node's job is reassigned
+ */
+void TCPServer::setHeartbeatTimeouts(int intervalMs, int timeoutMs, int slowRttMs) {
+	heartbeatIntervalMs = intervalMs;
+	heartbeatTimeoutMs = timeoutMs;
+	slowSlaveRttMs = slowRttMs;
 }
 
 /**********************************************************************************************
@@ -110,26 +112,31 @@ void TCPServer::listenSvr() {
 		} else {
 			// ensure ip address is white listed
 			if (!checkIfIPWhiteListed(ipAddrStr)) {
-				log("WARN: IP address isn't white listed! Refusing connection. IP address is: " + ipAddrStr);
+				LOG(logger, WARN, "IP address isn't white listed! Refusing connection. IP address is: " + ipAddrStr);
 				close(connection); // close the connection
 				continue; // skip adding connection
 			}
 
-			log("INFO: IP address is on white list. Accepting connection. IP address is: " + ipAddrStr);
+			LOG(logger, INFO, "IP address is on white list. Accepting connection. IP address is: " + ipAddrStr);
 
 			// determine whether this is a slave node, or the main server connecting...
 			if (ipAddrStr.compare(mainServerIpAddress) == 0) { // this is the main server
 				mainServerConnId = connection; // remember connection ID of main server
 				std::thread mainServerThread(&TCPServer::mainServerThread, this, connection, ipAddrStr);
 				mainServerThread.detach(); // make thread a daemon
-				log("INFO: connected with main server at " + ipAddrStr);
+				LOG(logger, INFO, "connected with main server at " + ipAddrStr);
 				mainServerAlive = true;
 			} else { // assume this is a slave node... (should ip address = 127.0.0.2)
 				// start slave node thread
 				std::thread clientThread(&TCPServer::clientThread, this, connection, ipAddrStr);
 				clientThread.detach(); // make thread a daemon
+				slavesMutex.lock();
 				this->slaveConns.push_back(connection);
-				log("INFO: connected with slave node at " + ipAddrStr + ":" + std::to_string(port));
+				SlaveNode slaveNode;
+				slaveNode.conn = connection;
+				slaveNodes[connection] = slaveNode; // capabilities get filled in once the slave sends REGISTER
+				slavesMutex.unlock();
+				LOG(logger, INFO, "connected with slave node at " + ipAddrStr + ":" + std::to_string(port));
 			}
 		}
 	}
@@ -158,43 +165,78 @@ bool TCPServer::checkIfIPWhiteListed(std::string ipAddr) {
 }
 
 /*
- * sendMessage: interface to send messages to a client.
+ * sendMessage: interface to send messages to a client. Messages are newline terminated so the
+ * receiver can tell where one ends when several arrive in the same read. send can take only part
+ * of a message when the socket buffer is nearly full, so the rest is sent until it's all gone.
  *
  *   Params: conn - connection fd
  *           msg - message to send to client
  *
- *   Throws: runtime_error if unable to send message to client.
+ *   Returns: false if the connection failed before all of it was sent (e.g. a dead slave node).
  */
-void TCPServer::sendMessage(int conn, std::string msg) {
-	try {
-		send(conn, msg.c_str(), msg.length(), 0);
-	} catch (std::exception& e) {
-		throw std::runtime_error("Failed to send message to client!");
+bool TCPServer::sendMessage(int conn, std::string msg) {
+	if (msg.empty() || msg.back() != '\n')
+		msg += "\n";
+
+	size_t sent = 0;
+	while (sent < msg.length()) {
+		auto n = send(conn, msg.c_str() + sent, msg.length() - sent, MSG_NOSIGNAL); // dead slave nodes shouldn't take us down with SIGPIPE
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		sent += n;
 	}
+	return true;
 }
 
 /*
- * receiveMessage: interface to receive messages from client.
+ * sendMessages: sends several messages to one client with a single send.
  *
  *   Params: conn - connection fd
+ *           msgs - messages to send to client, in order
  *
- *   Returns "FAILED" if client disconnected
+ *   Returns: false if the connection failed before all of them were sent.
  */
-std::string TCPServer::receiveMessage(int conn) {
-	char buffer[2048] = "";
-	try {
-		auto bytesToRead = read(conn, buffer, sizeof(buffer));
+bool TCPServer::sendMessages(int conn, const std::vector<std::string>& msgs) {
+	std::string joined;
+	for (auto& msg : msgs) {
+		joined += msg;
+		if (msg.empty() || msg.back() != '\n')
+			joined += "\n";
+	}
+	if (joined.empty())
+		return true;
+	return sendMessage(conn, joined);
+}
 
-		if (bytesToRead < 1) {
-			return "FAILED";
-		}
-	} catch (std::exception& e) {
-		return "FAILED";
+/*
+ * receiveMessages: reads whatever is available from a client and splits it into complete
+ * newline terminated messages. A trailing partial message is kept in pending until the rest of
+ * it arrives.
+ *
+ *   Params: conn - connection fd
+ *           pending - bytes received from this connection that don't yet form a full message
+ *           messages - filled with the complete messages received
+ *
+ *   Returns false if client disconnected
+ */
+bool TCPServer::receiveMessages(int conn, std::string& pending, std::vector<std::string>& messages) {
+	char buffer[2048];
+
+	auto bytesRead = read(conn, buffer, sizeof(buffer));
+	if (bytesRead < 1)
+		return false;
+
+	pending.append(buffer, bytesRead);
+
+	std::string::size_type newlinePos;
+	while ((newlinePos = pending.find('\n')) != std::string::npos) {
+		messages.push_back(pending.substr(0, newlinePos));
+		pending.erase(0, newlinePos + 1);
 	}
 
-	std::string userString(buffer);
-	
-	return userString;
+	return true;
 }
 
 /*
@@ -211,46 +253,65 @@ void TCPServer::clientThread(int conn, std::string ipAddrStr) {
 	client.conn = conn;
 	client.ipAddress = ipAddrStr;
 
+	std::string pending;
+	std::vector<std::string> messages;
+
 	// wait for messages from client
 	while (true) {
-		auto userString = receiveMessage(conn);
+		messages.clear();
 
 		// check if client still connected
-		if (userString.compare("FAILED") == 0)
+		if (!receiveMessages(conn, pending, messages))
 		{
 			markSlaveConnAsDead(conn);
 			break; 
 		}
 
-		auto sanitizedInput = sanitizeUserInput(userString); // sanitize user input
+		touchSlaveNode(conn);
+
+		for (auto& message : messages) {
+			auto sanitizedInput = sanitizeUserInput(message); // sanitize user input
 
-		log("INFO: received message from slave node " + std::to_string(conn) + ": " + sanitizedInput);
+			if (sanitizedInput.compare(0, 15, "HEARTBEAT_RESP|") != 0) // heartbeats would drown out everything else in the log
+				LOG(logger, INFO, "received message from slave node " + std::to_string(conn) + ": " + sanitizedInput);
 
-		handleMessage(sanitizedInput, conn);
+			handleMessage(sanitizedInput, conn);
+		}
 	}
 
-	log("INFO: closing/lost connection with client " + client.name + ". IP address is :" + ipAddrStr);
+	LOG(logger, INFO, "closing/lost connection with client " + client.name + ". IP address is :" + ipAddrStr);
+
+	// don't give the fd back to the OS (where a new slave node could be handed it) until jmd has
+	// reset every job that was assigned to it
+	while (checkIfSlaveConnDead(conn))
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	close(conn);
 }
 
 void TCPServer::mainServerThread(int conn, std::string ipAddrStr) {
+	std::string pending;
+	std::vector<std::string> messages;
+
 	// wait for messages from main server
 	while (true) {
-		auto message = receiveMessage(mainServerConnId);
+		messages.clear();
 
-		if (message.compare("FAILED") == 0) {  // check if still connected to main server
-			log("WARN: lost connection with main server!");
+		if (!receiveMessages(conn, pending, messages)) {  // check if still connected to main server
+			LOG(logger, WARN, "lost connection with main server!");
 			mainServerAlive = false;
 			break;
 		}
 
-		auto sanitizedInput = sanitizeUserInput(message);
+		for (auto &message : messages) {
+			auto sanitizedInput = sanitizeUserInput(message);
 
-		log("INFO: received message from main server: " + sanitizedInput);
-		
-		handleMessage(sanitizedInput, conn);
+			LOG(logger, INFO, "received message from main server: " + sanitizedInput);
+			
+			handleMessage(sanitizedInput, conn);
+		}
 	}
 
-	log("INFO: closing/lost connection with main server.");
+	LOG(logger, INFO, "closing/lost connection with main server.");
 }
 
 /*
@@ -283,75 +344,190 @@ void TCPServer::handleMessage(std::string msg, int conn) {
 	auto messageType = splitMessage.at(0);
 
 	if (messageType.compare("FACTOR_REQ") == 0) {
-		std::string clientId;
+		int clientId;
+		int requestId;
 		std::string numberToFactorize;
+		unsigned long budgetMs = 0;
+		unsigned long budgetIterations = 0;
 		try {
-			clientId = splitMessage.at(1);
-			numberToFactorize = splitMessage.at(2);
+			clientId = stoi(splitMessage.at(1));
+			requestId = stoi(splitMessage.at(2));
+			numberToFactorize = splitMessage.at(3);
+			if (splitMessage.size() > 5) {
+				budgetMs = stoul(splitMessage.at(4));
+				budgetIterations = stoul(splitMessage.at(5));
+			}
 		} catch (std::exception& e) {
-			log("WARN: Failed to receive FACTOR_REQ. Expected message of format FACTOR_REQ|clientId|numberToFactorize, but got: " + msg);
+			LOG(logger, WARN, "Failed to receive FACTOR_REQ. Expected message of format FACTOR_REQ|clientId|requestId|numberToFactorize[|budgetMs|budgetIterations], but got: " + msg);
 			return;
 		}
 
-		// add jobs to jobs vector for request
-		for (int i=0; i < numberOfJobsPerClientReq; i++)
-			jobs.push_back(std::make_tuple(-1, stoi(clientId), numberToFactorize, false, false));
-		log("INFO: added " + std::to_string(numberOfJobsPerClientReq) + " of following job: (-1, " + clientId + ", " + numberToFactorize + ", " + "false, false)");
+		// a number no slave node can hold would wait for one forever, so it is answered right away
+		auto bits = getBitLength(numberToFactorize);
+		if (isTooWideForSlaveNodes(bits)) {
+			requestsReceived.add();
+			completedJobsMutex.lock();
+			completedJobs.push(std::make_tuple(clientId, requestId, numberToFactorize, "", "", "number too wide (" + std::to_string(bits) + " bits) for every slave node"));
+			completedJobsMutex.unlock();
+			completedJobsCv.notify_one();
+			LOG(logger, WARN, "rejected request (clientId=" + std::to_string(clientId) + ", requestId=" + std::to_string(requestId) + ", numberToFactorize=" + numberToFactorize + "): " + std::to_string(bits) + " bits is wider than any slave node can factor");
+			return;
+		}
+
+		// add a job to jobs vector for request; jmd adds copies later if it straggles
+		jobsMutex.lock();
+		auto job = makeJob(clientId, requestId, numberToFactorize);
+		job.budgetMs = budgetMs;
+		job.budgetIterations = budgetIterations;
+		job.deadline = job.createdTime + std::chrono::milliseconds(budgetMs);
+		jobs.push_back(job);
+		jobsMutex.unlock();
+		requestsReceived.add();
+		Trace::get().record(tr_job_created, clientId, requestId, job.seed);
+		LOG(logger, INFO, "added following job: (-1, " + std::to_string(clientId) + ", " + std::to_string(requestId) + ", " + numberToFactorize + ", seed=" + std::to_string(job.seed) + ")");
 
 	} else if (messageType.compare("POLLARD_RESP") == 0) {
 		std::string slaveNodeId;
-		std::string clientId;
+		int clientId;
 		std::string numberToFactorize;
 		std::string primes;
+		unsigned long jobId;
+		std::string methods; // factoring methods that split the number on the slave node
+		std::string unfactored; // cofactors the slave node didn't get to before the budget ran out
 
 		try {
 			slaveNodeId = splitMessage.at(1);
-			clientId = splitMessage.at(2);
+			clientId = stoi(splitMessage.at(2));
 			numberToFactorize = splitMessage.at(3);
 			primes = splitMessage.at(4);
+			jobId = stoul(splitMessage.at(5));
+			if (splitMessage.size() > 6)
+				methods = splitMessage.at(6);
+			if (splitMessage.size() > 7)
+				unfactored = splitMessage.at(7);
 		} catch (std::exception& e) {
-			log("WARN: failed to receive POLLARD_RESP. Expected message of format POLLARD_RESP|slaveConnId|clientId|numberToFactorize|prime1,prime2,...,primeN, but got: " + msg);
+			LOG(logger, WARN, "failed to receive POLLARD_RESP. Expected message of format POLLARD_RESP|slaveConnId|clientId|numberToFactorize|prime1,prime2,...,primeN|jobId[|method1,...,methodN[|cofactor1,...,cofactorN]], but got: " + msg);
 			return;
 		}
 
 		jobsMutex.lock();
-		if (!checkIfJobCancelled(stoi(slaveNodeId))) { // make sure this job wasn't cancelled before doing the following...
+		auto job = findJob(stoi(slaveNodeId), jobId);
+		if (job == nullptr) { // the request id lives on the job, so without it there's no one to answer
+			jobsMutex.unlock();
+			LOG(logger, WARN, "no job " + std::to_string(jobId) + " assigned to slave node " + slaveNodeId + " for POLLARD_RESP: " + msg);
+		} else if (!job->cancelled && !job->done) { // make sure this job wasn't cancelled (or answered already) before doing the following...
+			// remember how long this took so jmd knows when jobs of this size are straggling. A
+			// partial result only says how long the budget was, so it isn't counted
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - job->startTime).count();
+			auto bits = job->bits;
+			if (unfactored.empty())
+				recordCompletionTime(bits, seconds);
+			double typicalSeconds = getTypicalSeconds(bits);
+			jobLatency.record((uint64_t) (seconds * 1e6));
+			auto requestId = job->requestId;
+			Trace::get().record(tr_result_received, clientId, requestId, job->seed, stoi(slaveNodeId));
+
 			// set job to done in jobs
-			setJobToDone(stoi(slaveNodeId)); 
+			setJobToDone(stoi(slaveNodeId), jobId); 
 
-			// set all other jobs with this (clientId, numberToFactorize) pair to cancelled
-			auto cancelledSlaveNodeIds = setJobsToCancelled(stoi(slaveNodeId), stoi(clientId), numberToFactorize);
+			// set all other jobs for this (clientId, requestId) pair to cancelled
+			auto cancelledJobs = setJobsToCancelled(jobId, clientId, requestId);
 			jobsMutex.unlock(); // releasing lock as soon as possible to avoid bottleneck
 
 			// send cancellation requests to cancelled nodes
-			for (auto cancelledNodeId : cancelledSlaveNodeIds) {
-				auto cancellationMessage = "CANCEL_REQ|" + std::to_string(cancelledNodeId);
-				sendMessage(cancelledNodeId, cancellationMessage);
-				log("DEBUG: sent cancellation message to slave with node id: " + std::to_string(cancelledNodeId));
+			for (auto& cancelledJob : cancelledJobs) {
+				auto cancellationMessage = "CANCEL_REQ|" + std::to_string(cancelledJob.first) + "|" + std::to_string(cancelledJob.second);
+				sendMessage(cancelledJob.first, cancellationMessage);
+				LOG(logger, DEBUG, "sent cancellation message for job " + std::to_string(cancelledJob.second) + " to slave with node id: " + std::to_string(cancelledJob.first));
 			}
 
+			if (unfactored.empty())
+				recordJobCompletion(stoi(slaveNodeId), seconds, typicalSeconds);
+			else
+				partialResults.add();
+
 			// add record to completed jobs
-			completedJobs.push(std::make_tuple(clientId, numberToFactorize, primes));
-			log("INFO: added (clientId=" + clientId + ",numberToFactorize=" + numberToFactorize + ",primes=" + primes + ") to completed jobs.");
+			completedJobsMutex.lock();
+			completedJobs.push(std::make_tuple(clientId, requestId, numberToFactorize, primes, unfactored, ""));
+			completedJobsMutex.unlock();
+			completedJobsCv.notify_one();
+			LOG(logger, INFO, "added (clientId=" + std::to_string(clientId) + ",requestId=" + std::to_string(requestId) + ",numberToFactorize=" + numberToFactorize + ",primes=" + primes + ",methods=" + methods + (unfactored.empty() ? "" : ",unfactored=" + unfactored) + ") to completed jobs.");
 		} else {
 			jobsMutex.unlock();
 		}
-	} else if (messageType.compare("CANCEL_RESP") == 0) {
+	} else if (messageType.compare("POLLARD_ERR") == 0) {
 		std::string slaveNodeId;
+		int clientId;
+		std::string numberToFactorize;
+		unsigned long jobId;
+		std::string error;
 
 		try {
 			slaveNodeId = splitMessage.at(1);
+			clientId = stoi(splitMessage.at(2));
+			numberToFactorize = splitMessage.at(3);
+			jobId = stoul(splitMessage.at(4));
+			error = splitMessage.at(5);
 		} catch (std::exception& e) {
-			log("WARN: failed to receive CANCEL_RESP. Expected message of format CANCEL_RESP|slaveConnId, but got: " + msg);
+			LOG(logger, WARN, "failed to receive POLLARD_ERR. Expected message of format POLLARD_ERR|slaveConnId|clientId|numberToFactorize|jobId|error, but got: " + msg);
+			return;
+		}
+
+		// the slave node couldn't take the number at all, so the request is answered with its error
+		jobsMutex.lock();
+		auto job = findJob(stoi(slaveNodeId), jobId);
+		if (job == nullptr) {
+			jobsMutex.unlock();
+			LOG(logger, WARN, "no job " + std::to_string(jobId) + " assigned to slave node " + slaveNodeId + " for POLLARD_ERR: " + msg);
+		} else if (!job->cancelled && !job->done) {
+			auto requestId = job->requestId;
+			setJobToDone(stoi(slaveNodeId), jobId);
+			auto cancelledJobs = setJobsToCancelled(jobId, clientId, requestId);
+			jobsMutex.unlock();
+
+			for (auto& cancelledJob : cancelledJobs)
+				sendMessage(cancelledJob.first, "CANCEL_REQ|" + std::to_string(cancelledJob.first) + "|" + std::to_string(cancelledJob.second));
+
+			completedJobsMutex.lock();
+			completedJobs.push(std::make_tuple(clientId, requestId, numberToFactorize, "", "", error));
+			completedJobsMutex.unlock();
+			completedJobsCv.notify_one();
+			LOG(logger, WARN, "slave node " + slaveNodeId + " couldn't factor (clientId=" + std::to_string(clientId) + ",requestId=" + std::to_string(requestId) + ",numberToFactorize=" + numberToFactorize + "): " + error);
+		} else {
+			jobsMutex.unlock();
+		}
+	} else if (messageType.compare("CHECKPOINT") == 0) {
+		if (splitMessage.size() < 8) {
+			LOG(logger, WARN, "failed to receive CHECKPOINT. Expected message of format CHECKPOINT|slaveConnId|clientId|numberToFactorize|prime1,...,primeN|cofactor1,...,cofactorN|n:x:y:c|jobId, but got: " + msg);
+			return;
+		}
+		recordCheckpoint(splitMessage);
+	} else if (messageType.compare("REGISTER") == 0) {
+		registerSlaveNode(conn, splitMessage);
+	} else if (messageType.compare("HEARTBEAT_RESP") == 0) {
+		try {
+			recordHeartbeatResponse(conn, splitMessage.at(1));
+		} catch (std::exception& e) {
+			LOG(logger, WARN, "failed to receive HEARTBEAT_RESP. Expected message of format HEARTBEAT_RESP|sentTimeMs, but got: " + msg);
+		}
+	} else if (messageType.compare("CANCEL_RESP") == 0) {
+		int slaveNodeId;
+		unsigned long jobId;
+
+		try {
+			slaveNodeId = stoi(splitMessage.at(1));
+			jobId = stoul(splitMessage.at(2));
+		} catch (std::exception& e) {
+			LOG(logger, WARN, "failed to receive CANCEL_RESP. Expected message of format CANCEL_RESP|slaveConnId|jobId, but got: " + msg);
 			return;
 		}
 
 		// mark job as done
 		jobsMutex.lock();
-		setJobToDone(stoi(slaveNodeId));
+		setJobToDone(slaveNodeId, jobId);
 		jobsMutex.unlock();
 	} else { // unknown message type
-		log("WARN: Unknown message type in message. Cannot handle! Message was: " + msg);
+		LOG(logger, WARN, "Unknown message type in message. Cannot handle! Message was: " + msg);
 	}
 }
 
@@ -377,81 +553,422 @@ std::string TCPServer::sanitizeUserInput(const std::string& s) {
 
 
 // utility functions below...
-std::vector<int> TCPServer::getAvailableSlaveNodeIds() {
-	std::vector<int> occupiedSlaveNodeIds;
+/*
+	getFreeSlots - how many more jobs each slave node with room to spare can take: the cores it
+	announced less the jobs assigned to it. Slave nodes that haven't registered yet take one.
+	This method should be mutexed with jobsMutex before calling!
+*/
+std::map<int, int> TCPServer::getFreeSlots() {
+	std::map<int, int> assignedJobs; // slaveNodeId -> jobs assigned to it
 	for (auto const& job : jobs) {
-		auto slaveNodeId = std::get<0>(job);
+		auto slaveNodeId = job.slaveNodeId;
 
 		if (slaveNodeId != -1)
-			occupiedSlaveNodeIds.push_back(slaveNodeId);
+			assignedJobs[slaveNodeId]++;
+	}
+
+	std::map<int, int> freeSlots;
+
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	for (auto slaveNodeId : slaveConns) {
+		int capacity = 1;
+		auto it = slaveNodes.find(slaveNodeId);
+		if (it != slaveNodes.end() && it->second.registered)
+			capacity = std::max(1, it->second.cores);
+
+		if (assignedJobs[slaveNodeId] < capacity)
+			freeSlots[slaveNodeId] = capacity - assignedJobs[slaveNodeId];
 	}
 
-	// calculate difference between all slave node id's and occupied ones
-	std::vector<int> diff;
+	return freeSlots;
+}
+
+/*
+	getAvailableSlaveNodeIds - slave nodes that can take another job (see getFreeSlots).
+	This method should be mutexed with jobsMutex before calling!
+*/
+std::vector<int> TCPServer::getAvailableSlaveNodeIds() {
+	std::vector<int> available;
+	for (auto& slots : getFreeSlots())
+		available.push_back(slots.first);
+	return available;
+}
+
+/*
+	pickSlaveNode - chooses which of the available slave nodes should factor a number. Slaves
+	that announced a maximum width smaller than the number are skipped. Of the rest, numbers at
+	least largeNumberBits wide go to the fastest slave (by benchmark score) and smaller numbers
+	go to the slowest, keeping the fast slaves free for the big numbers. Slaves that have not
+	registered yet are treated as capable with a score of 0. Slaves flagged slow by the health
+	monitor are only used when nothing else can take the job.
+
+	Params:
+		availableSlaveNodeIds - slave nodes that can take another job
+		bits - bit length of the number the job is for
+
+	Returns:
+		the chosen slave node id, or -1 if no available slave node can handle the number
+*/
+int TCPServer::pickSlaveNode(const std::vector<int>& availableSlaveNodeIds, int bits) {
+	// (benchmarkScore, slaveNodeId) of each capable slave node, slow ones kept separately as a fallback
+	std::vector<std::pair<double, int>> capableSlaveNodes;
+	std::vector<std::pair<double, int>> slowSlaveNodes;
+
+	slavesMutex.lock();
+	for (auto slaveNodeId : availableSlaveNodeIds) {
+		auto it = slaveNodes.find(slaveNodeId);
+		if (it == slaveNodes.end())
+			continue;
+
+		auto& slaveNode = it->second;
+		if (slaveNode.registered && slaveNode.maxBits < bits)
+			continue; // number is too wide for this slave
+
+		if (slaveNode.slow)
+			slowSlaveNodes.push_back(std::make_pair(slaveNode.benchmarkScore, slaveNodeId));
+		else
+			capableSlaveNodes.push_back(std::make_pair(slaveNode.benchmarkScore, slaveNodeId));
+	}
+	slavesMutex.unlock();
 
-	auto slaveNodeIds = slaveConns;
+	if (capableSlaveNodes.empty())
+		capableSlaveNodes = slowSlaveNodes;
 
-	std::sort(slaveNodeIds.begin(), slaveNodeIds.end());
-	std::sort(occupiedSlaveNodeIds.begin(), occupiedSlaveNodeIds.end());
+	if (capableSlaveNodes.empty())
+		return -1;
 
-	std::set_difference(slaveNodeIds.begin(), slaveNodeIds.end(), occupiedSlaveNodeIds.begin(), occupiedSlaveNodeIds.end(),
-        std::inserter(diff, diff.begin()));
+	std::sort(capableSlaveNodes.begin(), capableSlaveNodes.end());
 
-	return diff;
+	if (bits >= largeNumberBits)
+		return capableSlaveNodes.back().second; // fastest
+	return capableSlaveNodes.front().second; // slowest
 }
 
+/*
+	registerSlaveNode - records the capabilities a slave node announced. Expects a message of format
+	REGISTER|cores|width1,width2,...|algorithm1,algorithm2,...|benchmarkScore
+
+	Params:
+		connId - connection id of the slave node
+		splitMessage - the REGISTER message split on '|'
+*/
+void TCPServer::registerSlaveNode(int connId, const std::vector<std::string>& splitMessage) {
+	SlaveNode slaveNode;
+	slaveNode.conn = connId;
+
+	try {
+		slaveNode.cores = stoi(splitMessage.at(1));
+
+		std::vector<std::string> widths;
+		boost::algorithm::split(widths, splitMessage.at(2), boost::is_any_of(","));
+		for (auto& width : widths)
+			slaveNode.maxBits = std::max(slaveNode.maxBits, stoi(width));
+
+		boost::algorithm::split(slaveNode.algorithms, splitMessage.at(3), boost::is_any_of(","));
+		slaveNode.benchmarkScore = stod(splitMessage.at(4));
+	} catch (std::exception& e) {
+		LOG(logger, WARN, "failed to receive REGISTER. Expected message of format REGISTER|cores|width1,...,widthN|algorithm1,...,algorithmN|benchmarkScore, but got: " + boost::algorithm::join(splitMessage, "|"));
+		return;
+	}
+	slaveNode.registered = true;
+
+	slavesMutex.lock();
+	if (std::count(slaveConns.begin(), slaveConns.end(), connId))
+		slaveNodes[connId] = slaveNode;
+	slavesMutex.unlock();
+
+	LOG(logger, INFO, "registered slave node " + std::to_string(connId) + " (cores=" + std::to_string(slaveNode.cores) + ", maxBits=" + std::to_string(slaveNode.maxBits) + ", algorithms=" + boost::algorithm::join(slaveNode.algorithms, ",") + ", benchmarkScore=" + std::to_string(slaveNode.benchmarkScore) + ")");
+}
+
+/*
+	getBitLength - returns the number of bits needed to hold a decimal number, or 0 if the string
+	isn't a number. Numbers too wide for 512 bits are estimated from their digit count.
+*/
+int TCPServer::getBitLength(const std::string& number) {
+	boost::multiprecision::uint512_t n;
+	if (parseDecimal(number, n))
+		return n == 0 ? 0 : (int) boost::multiprecision::msb(n) + 1;
+	if (!isDecimal(number))
+		return 0;
+
+	auto digits = number.length() - std::min(number.find_first_not_of('0'), number.length());
+	return (int) std::ceil(digits * std::log2(10.0));
+}
+
+/*
+	isTooWideForSlaveNodes - true when slave nodes are connected, all of them have registered, and
+	none announced a width of at least bits, so a job for the number could never be assigned. With
+	no slave nodes connected (or some not registered yet) the job waits for one that might fit.
+*/
+bool TCPServer::isTooWideForSlaveNodes(int bits) {
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	if (slaveConns.empty())
+		return false;
+
+	for (auto slaveNodeId : slaveConns) {
+		auto it = slaveNodes.find(slaveNodeId);
+		if (it == slaveNodes.end() || !it->second.registered || it->second.maxBits >= bits)
+			return false;
+	}
+	return true;
+}
+
+/*
+	Safe to call more than once for the same connection (the health monitor and the slave node's
+	client thread can both notice it is gone).
+*/
 void TCPServer::markSlaveConnAsDead(int connId) {
-	deadSlaveConns.push_back(connId); // show that this conn is so outbound jobs assigned to this conn can be re-assigned
-	slaveConns.erase(std::remove(slaveConns.begin(), slaveConns.end(), connId)); // remove conn from our list of active slave nodes
+	slavesMutex.lock();
+	if (std::count(slaveConns.begin(), slaveConns.end(), connId)) {
+		deadSlaveConns.push_back(connId); // show that this conn is so outbound jobs assigned to this conn can be re-assigned
+		slaveConns.erase(std::remove(slaveConns.begin(), slaveConns.end(), connId), slaveConns.end()); // remove conn from our list of active slave nodes
+		slaveNodes.erase(connId);
+	}
+	slavesMutex.unlock();
+}
+
+bool TCPServer::checkIfSlaveConnDead(int connId) {
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	return std::count(deadSlaveConns.begin(), deadSlaveConns.end(), connId) > 0;
+}
+
+void TCPServer::touchSlaveNode(int connId) {
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	auto it = slaveNodes.find(connId);
+	if (it != slaveNodes.end())
+		it->second.lastSeen = std::chrono::steady_clock::now();
+}
+
+/*
+	ewma - exponentially weighted moving average. The first sample seeds the average.
+*/
+double TCPServer::ewma(double average, double sample, long samples) {
+	if (samples == 0)
+		return sample;
+	return ewmaAlpha * sample + (1 - ewmaAlpha) * average;
+}
+
+/*
+	recordHeartbeatResponse - slave nodes echo back the send time of each HEARTBEAT, which gives us
+	the round trip time.
+*/
+void TCPServer::recordHeartbeatResponse(int connId, const std::string& sentTimeMs) {
+	auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	double rttMs = nowMs - stoll(sentTimeMs);
+
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	auto it = slaveNodes.find(connId);
+	if (it == slaveNodes.end())
+		return;
+
+	auto& slaveNode = it->second;
+	slaveNode.rttEwmaMs = ewma(slaveNode.rttEwmaMs, rttMs, slaveNode.heartbeatsAnswered++);
+}
+
+/*
+	recordJobCompletion - updates a slave node's slowdown average: the time since its job was
+	dispatched over the typical time for numbers of that size (0 until we know it, which leaves
+	the average alone). Comparing against the size's typical time keeps slave nodes that are
+	given the big numbers from looking slow.
+*/
+void TCPServer::recordJobCompletion(int connId, double seconds, double typicalSeconds) {
+	if (seconds <= 0)
+		return;
+
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	auto it = slaveNodes.find(connId);
+	if (it == slaveNodes.end())
+		return;
+
+	auto& slaveNode = it->second;
+	slaveNode.jobsCompleted++;
+	slaveNode.busySeconds += seconds;
+	if (typicalSeconds > 0)
+		slaveNode.slowdownEwma = ewma(slaveNode.slowdownEwma, seconds / typicalSeconds, slaveNode.slowdownSamples++);
 }
 
-bool TCPServer::checkIfJobCancelled(int inSlaveNodeId) {
+/*
+	reassignSlaveNodeJobs - cancels the jobs a slave node is working on and queues a copy of each
+	so jmd hands them to other slave nodes. The originals stay assigned (as cancelled) until the
+	slave node's CANCEL_RESPs come back, so the slave node isn't handed new work before then.
+*/
+void TCPServer::reassignSlaveNodeJobs(int connId) {
+	std::vector<std::string> cancellations;
+
+	jobsMutex.lock();
+	std::vector<Job> copies;
 	for (auto& job : jobs) {
-		auto slaveNodeId = std::get<0>(job);
-		auto cancelled = std::get<4>(job);
+		if (job.slaveNodeId != connId || job.done || job.cancelled)
+			continue;
+		job.cancelled = true; // cancel it on the slow slave node
+		copies.push_back(makeJob(job, true));
+		cancellations.push_back("CANCEL_REQ|" + std::to_string(connId) + "|" + std::to_string(job.jobId));
+	}
+	jobs.insert(jobs.end(), copies.begin(), copies.end());
+	jobsMutex.unlock();
+
+	if (!cancellations.empty()) {
+		LOG(logger, WARN, "reassigning " + std::to_string(cancellations.size()) + " job(s) of slow slave node " + std::to_string(connId));
+		sendMessages(connId, cancellations);
+	}
+}
+
+/*
+	makeJob - a new unassigned job, with its own seed so no two copies walk the same sequence.
+	This method should be mutexed with jobsMutex before calling!
+*/
+Job TCPServer::makeJob(int clientId, int requestId, const std::string& numberToFactorize) {
+	Job job;
+	job.clientId = clientId;
+	job.requestId = requestId;
+	job.numberToFactorize = numberToFactorize;
+	job.bits = getBitLength(numberToFactorize);
+	job.seed = seedGenerator();
+	job.jobId = nextJobId++;
+	return job;
+}
+
+/*
+	makeJob - a new unassigned copy of a job with its own seed. It starts from the original's last
+	checkpoint, so primes already found aren't searched for again. The rho walk in progress is
+	only carried over when the original is being abandoned (resumeWalk); a speculative copy
+	wants a different walk. This method should be mutexed with jobsMutex before calling!
+*/
+Job TCPServer::makeJob(const Job& original, bool resumeWalk) {
+	auto job = makeJob(original.clientId, original.requestId, original.numberToFactorize);
+	job.budgetMs = original.budgetMs;
+	job.budgetIterations = original.budgetIterations;
+	job.deadline = original.deadline;
+	job.hasCheckpoint = original.hasCheckpoint;
+	job.checkpointPrimes = original.checkpointPrimes;
+	job.checkpointCofactors = original.checkpointCofactors;
+	if (resumeWalk)
+		job.checkpointWalk = original.checkpointWalk;
+	return job;
+}
 
-		if (slaveNodeId == inSlaveNodeId)
-			return cancelled;
+/*
+	recordCheckpoint - stores the progress a slave node reported on one of its jobs. Expects the
+	CHECKPOINT message split on '|' (at least 8 fields).
+*/
+void TCPServer::recordCheckpoint(const std::vector<std::string>& splitMessage) {
+	int slaveNodeId;
+	unsigned long jobId;
+	try {
+		slaveNodeId = stoi(splitMessage.at(1));
+		jobId = stoul(splitMessage.at(7));
+	} catch (std::exception& e) {
+		LOG(logger, WARN, "failed to receive CHECKPOINT. Bad slave node id or job id: " + boost::algorithm::join(splitMessage, "|"));
+		return;
 	}
 
-	log("DEBUG: when checking if job assigned to slave node " + std::to_string(inSlaveNodeId) + " was cancelled, failed to find a job in jobs with this slave node id");
-	return false; // otherwise, no entry found, so a non-existent job can't be cancelled...
+	std::lock_guard<std::mutex> lock(jobsMutex);
+	auto job = findJob(slaveNodeId, jobId);
+	if (job == nullptr || job->done || job->cancelled || job->numberToFactorize != splitMessage.at(3))
+		return;
+
+	job->hasCheckpoint = true;
+	job->checkpointPrimes = splitMessage.at(4);
+	job->checkpointCofactors = splitMessage.at(5);
+	job->checkpointWalk = splitMessage.at(6);
+	LOG(logger, DEBUG, "checkpoint for job (clientId=" + std::to_string(job->clientId) + ", numberToFactorize=" + job->numberToFactorize + ") on slave node " + std::to_string(slaveNodeId) + ": primes=" + job->checkpointPrimes + ", cofactors=" + job->checkpointCofactors);
 }
 
 /*
 	This method should be mutexed with jobsMutex before calling!
 */
-void TCPServer::setJobToDone(int inSlaveNodeId) {
+Job* TCPServer::findJob(int inSlaveNodeId, unsigned long inJobId) {
 	for (auto& job : jobs) {
-		auto slaveNodeId = std::get<0>(job);
+		if (job.slaveNodeId == inSlaveNodeId && job.jobId == inJobId)
+			return &job;
+	}
+	return nullptr;
+}
 
-		if (slaveNodeId == inSlaveNodeId) {
-			std::get<3>(job) = true; // set job to complete
-			return;
-		} 
+/*
+	recordCompletionTime - keeps the last completionSamplesPerBucket completion times for numbers
+	of about this size. This method should be mutexed with jobsMutex before calling!
+*/
+void TCPServer::recordCompletionTime(int bits, double seconds) {
+	auto bucket = (bits + bitLengthBucketSize - 1) / bitLengthBucketSize;
+	auto& times = completionTimes[bucket];
+
+	times.push_back(seconds);
+	if (times.size() > completionSamplesPerBucket)
+		times.pop_front();
+}
+
+/*
+	getSpeculationThresholdMs - how long a job for this number may run before it counts as a
+	straggler: speculationPercentile of recent completion times for numbers of about this size,
+	or speculateAfterMs until we've seen minSamplesForSpeculation of them. Never below
+	minSpeculationMs. This method should be mutexed with jobsMutex before calling!
+*/
+double TCPServer::getSpeculationThresholdMs(int bits) {
+	auto bucket = (bits + bitLengthBucketSize - 1) / bitLengthBucketSize;
+	auto it = completionTimes.find(bucket);
+
+	if (it == completionTimes.end() || it->second.size() < (unsigned int) minSamplesForSpeculation)
+		return std::max(speculateAfterMs, minSpeculationMs);
+
+	std::vector<double> times(it->second.begin(), it->second.end());
+	auto nth = times.begin() + (size_t) (speculationPercentile * (times.size() - 1));
+	std::nth_element(times.begin(), nth, times.end());
+
+	return std::max(*nth * 1000.0, (double) minSpeculationMs);
+}
+
+/*
+	getTypicalSeconds - median of recent completion times for numbers of about this size, or 0
+	until we've seen minSamplesForSpeculation of them. This method should be mutexed with
+	jobsMutex before calling!
+*/
+double TCPServer::getTypicalSeconds(int bits) {
+	auto bucket = (bits + bitLengthBucketSize - 1) / bitLengthBucketSize;
+	auto it = completionTimes.find(bucket);
+
+	if (it == completionTimes.end() || it->second.size() < (unsigned int) minSamplesForSpeculation)
+		return 0;
+
+	std::vector<double> times(it->second.begin(), it->second.end());
+	auto mid = times.begin() + times.size() / 2;
+	std::nth_element(times.begin(), mid, times.end());
+	return *mid;
+}
+
+/*
+	This method should be mutexed with jobsMutex before calling!
+*/
+void TCPServer::setJobToDone(int inSlaveNodeId, unsigned long inJobId) {
+	auto job = findJob(inSlaveNodeId, inJobId);
+	if (job != nullptr) {
+		job->done = true; // set job to complete
+		return;
 	}
 
-	log("DEBUG: when trying to set job to done for slave node " + std::to_string(inSlaveNodeId) + ", failed to find a job in jobs with this slave node id");
+	LOG(logger, DEBUG, "when trying to set job " + std::to_string(inJobId) + " to done for slave node " + std::to_string(inSlaveNodeId) + ", failed to find it in jobs");
 }
 
 /*
 	This method should be mutexed with jobsMutex before calling!
 */
-std::vector<int> TCPServer::setJobsToCancelled(int inSlaveNodeId, int inClientId, std::string inNumberToFactorize) {
-	std::vector<int> cancelledSlaveNodeIds;
+std::vector<std::pair<int, unsigned long>> TCPServer::setJobsToCancelled(unsigned long inJobId, int inClientId, int inRequestId) {
+	std::vector<std::pair<int, unsigned long>> cancelledJobs;
 	for (auto& job : jobs) {
-		auto slaveNodeId = std::get<0>(job);
-		auto clientId = std::get<1>(job);
-		auto numberToFactorize = std::get<2>(job);
-
-		if (slaveNodeId != inSlaveNodeId && clientId == inClientId && numberToFactorize.compare(inNumberToFactorize) == 0) {
-			std::get<4>(job) = true; // set job to cancelled
-			log("DEBUG: cancelling job (slaveNodeId=" + std::to_string(slaveNodeId) + ",clientId=" + std::to_string(clientId) + ",numberToFactorize=" + numberToFactorize + ") ");
-			cancelledSlaveNodeIds.push_back(slaveNodeId);
+		auto slaveNodeId = job.slaveNodeId;
+		auto clientId = job.clientId;
+		auto numberToFactorize = job.numberToFactorize;
+
+		if (job.jobId != inJobId && clientId == inClientId && job.requestId == inRequestId && !job.cancelled) {
+			job.cancelled = true; // set job to cancelled
+			jobsCancelled.add();
+			LOG(logger, DEBUG, "cancelling job (slaveNodeId=" + std::to_string(slaveNodeId) + ",clientId=" + std::to_string(clientId) + ",numberToFactorize=" + numberToFactorize + ") ");
+			if (slaveNodeId != -1) // unassigned jobs have no slave node to tell
+				cancelledJobs.push_back(std::make_pair(slaveNodeId, job.jobId));
 		}
 	}
 
-	return cancelledSlaveNodeIds;
+	return cancelledJobs;
 }
 
 // Daemon services below...
@@ -462,80 +979,360 @@ std::vector<int> TCPServer::setJobsToCancelled(int inSlaveNodeId, int inClientId
 *		- assigns an available slave node to entry
 *		- sends job to assigned slave
 * - if a slave node dies, updates entry with slaveId=failedSlaveId and sets it back to -1
+* - if a job has run longer than most jobs of its size (see getSpeculationThresholdMs) and a slave
+*   node is idle, queues a copy of it with a different seed; the first copy to answer wins
+* - answers requests whose budget ran out before any slave node could take them with whatever
+*   their last checkpoint had
+* - answers requests for numbers wider than every connected slave node can hold with an error
+* - removes jobs that are done, or were cancelled before a slave node picked them up
+*
+* Holds jobsMutex for the whole pass over jobs; messages to slave nodes are sent once it's released.
 ***********************************************************************************************/
 void TCPServer::jmd() {
 	while (true) {
+		std::map<int, std::vector<std::string>> messagesToSend; // slaveNodeId -> messages, sent together
+		std::vector<Job> backupJobs; // speculative copies of straggling jobs
+		std::vector<Job> dispatchedJobs; // traced as their POLLARD_REQs are sent
+		std::vector<std::tuple<int, int, std::string, std::string, std::string, std::string>> expiredJobs; // answered from their checkpoint, see completedJobs
+		std::vector<std::tuple<int, int, std::string, std::string, std::string, std::string>> tooWideJobs; // answered with an error
+		auto now = std::chrono::steady_clock::now();
+
+		slavesMutex.lock();
+		auto deadSlaveNodeIds = deadSlaveConns;
+		slavesMutex.unlock();
+
+		jobsMutex.lock();
 		for (auto& job : jobs) {
-			auto slaveNodeId = std::get<0>(job);
-			auto clientId = std::get<1>(job);
-			auto numberToFactorize = std::get<2>(job);
-			auto done = std::get<3>(job);
-			auto cancelled = std::get<4>(job);
+			auto slaveNodeId = job.slaveNodeId;
+			auto clientId = job.clientId;
+			auto numberToFactorize = job.numberToFactorize;
+			auto done = job.done;
+			auto cancelled = job.cancelled;
+
+			// out of time while waiting for a slave node, with no copy of it running to answer instead
+			if (slaveNodeId == -1 && !done && !cancelled && job.budgetMs != 0 && now >= job.deadline && std::none_of(jobs.begin(), jobs.end(), [&job](const Job& other) {
+					return other.slaveNodeId != -1 && other.clientId == job.clientId && other.requestId == job.requestId && !other.done && !other.cancelled;
+				})) {
+				job.done = true;
+				setJobsToCancelled(job.jobId, clientId, job.requestId); // only unassigned copies are left
+				auto checkpointed = job.hasCheckpoint && !job.checkpointCofactors.empty();
+				expiredJobs.push_back(std::make_tuple(clientId, job.requestId, numberToFactorize, checkpointed ? job.checkpointPrimes : "", checkpointed ? job.checkpointCofactors : numberToFactorize, ""));
+				LOG(logger, INFO, "JMD :: budget of job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ") ran out before a slave node took it. Answering with what its last checkpoint found, if anything");
+				continue;
+			}
+
+			// no slave node connected now can hold the number (the ones that could have left since it arrived)
+			if (slaveNodeId == -1 && !done && !cancelled && isTooWideForSlaveNodes(job.bits) && std::none_of(jobs.begin(), jobs.end(), [&job](const Job& other) {
+					return other.slaveNodeId != -1 && other.clientId == job.clientId && other.requestId == job.requestId && !other.done && !other.cancelled;
+				})) {
+				job.done = true;
+				setJobsToCancelled(job.jobId, clientId, job.requestId);
+				tooWideJobs.push_back(std::make_tuple(clientId, job.requestId, numberToFactorize, "", "", "number too wide (" + std::to_string(job.bits) + " bits) for every slave node"));
+				LOG(logger, WARN, "JMD :: no slave node can factor job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + "). Answering with an error");
+				continue;
+			}
 
 			// check if no slave node working on this job, and that this job wasn't done or cancelled
 			if (slaveNodeId == -1 && !done && !cancelled) { 
 				auto availableSlaveNodes = getAvailableSlaveNodeIds();
 
-				// if there are available slave nodes, assign one to this job
-				if (availableSlaveNodes.size() > 0) {
-					auto newSlaveNodeId = availableSlaveNodes[0];
-					auto logStr = "INFO: JMD :: assigned (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") to slave node " + std::to_string(newSlaveNodeId);
-					log(logStr);
+				// a copy of a request is only worth running on a slave node not already working on it
+				availableSlaveNodes.erase(std::remove_if(availableSlaveNodes.begin(), availableSlaveNodes.end(), [this, &job](int id) {
+					return std::any_of(jobs.begin(), jobs.end(), [&job, id](const Job& other) {
+						return other.slaveNodeId == id && other.clientId == job.clientId && other.requestId == job.requestId && !other.done && !other.cancelled;
+					});
+				}), availableSlaveNodes.end());
 
-					jobsMutex.lock();
-					std::get<0>(job) = newSlaveNodeId; // assign new slave node id to job
-					jobsMutex.unlock();
+				// if there are available slave nodes, assign the best suited one to this job
+				auto newSlaveNodeId = pickSlaveNode(availableSlaveNodes, job.bits);
+				if (newSlaveNodeId != -1) {
+					auto logStr = "JMD :: assigned (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") to slave node " + std::to_string(newSlaveNodeId);
+					LOG(logger, INFO, logStr);
+
+					job.slaveNodeId = newSlaveNodeId; // assign new slave node id to job
+					job.startTime = now;
+					dispatchLatency.record(std::chrono::duration_cast<std::chrono::microseconds>(now - job.createdTime).count());
+					jobsDispatched.add();
 
 					// send job to slave node!
-					auto messageToSend = "POLLARD_REQ|" + std::to_string(newSlaveNodeId) + "|" + std::to_string(clientId) + "|" + numberToFactorize;
-					log("INFO: JMD :: sending message: " + messageToSend + " to slave node " + std::to_string(newSlaveNodeId));
-					sendMessage(newSlaveNodeId, messageToSend);
+					// the slave node gets what's left of the time budget, at least a millisecond so 0 still means no limit
+					unsigned long budgetMs = 0;
+					if (job.budgetMs != 0)
+						budgetMs = std::max(1L, (long) std::chrono::duration_cast<std::chrono::milliseconds>(job.deadline - now).count());
+					auto messageToSend = "POLLARD_REQ|" + std::to_string(newSlaveNodeId) + "|" + std::to_string(clientId) + "|" + numberToFactorize + "|" + std::to_string(job.seed) + "|" + std::to_string(job.jobId) + "|" + std::to_string(budgetMs) + "|" + std::to_string(job.budgetIterations);
+					if (job.hasCheckpoint) // pick up where the previous slave node left off
+						messageToSend += "|" + job.checkpointPrimes + "|" + job.checkpointCofactors + "|" + job.checkpointWalk;
+					LOG(logger, INFO, "JMD :: sending message: " + messageToSend + " to slave node " + std::to_string(newSlaveNodeId));
+					messagesToSend[newSlaveNodeId].push_back(messageToSend);
+					if (Trace::get().enabled())
+						dispatchedJobs.push_back(job);
 				}
-			} else if (std::count(deadSlaveConns.begin(), deadSlaveConns.end(), slaveNodeId)) { // check if this job is assigned to a dead slave node
-				auto logStr = "WARN: JMD:: slave node " + std::to_string(slaveNodeId) + " disconnected before we received a response. Resetting job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") back to slave node -1 (for reassignment)";
-				log(logStr);
-
-				jobsMutex.lock();
-				std::get<0>(job) = -1; // reset back to -1 so it will be reassigned to a slave node that is alive
-				jobsMutex.unlock();
-			} else if (done) { // remove job if it is complete/cancelled
-				jobsMutex.lock();
-				jobs.erase(std::remove(jobs.begin(), jobs.end(), job));
-				jobsMutex.unlock();
+			} else if (std::count(deadSlaveNodeIds.begin(), deadSlaveNodeIds.end(), slaveNodeId)) { // check if this job is assigned to a dead slave node
+				auto logStr = "JMD:: slave node " + std::to_string(slaveNodeId) + " disconnected before we received a response. Resetting job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") back to slave node -1 (for reassignment)";
+				LOG(logger, WARN, logStr);
+
+				job.slaveNodeId = -1; // reset back to -1 so it will be reassigned to a slave node that is alive
+			} else if (done) {
 				if (!cancelled)
-					log("DEBUG: JMD :: removed job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") from jobs. Adding to completed jobs.");
+					LOG(logger, DEBUG, "JMD :: removed job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") from jobs. Adding to completed jobs.");
 				else
-					log("DEBUG: JMD :: removed job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") from jobs since it was cancelled");
-		
+					LOG(logger, DEBUG, "JMD :: removed job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ", done=" + std::to_string(done) + ", cancelled=" + std::to_string(cancelled) + ") from jobs since it was cancelled");
+			} else if (slaveNodeId != -1 && !cancelled && !job.backupLaunched) { // running; check if it is straggling
+				auto runningMs = std::chrono::duration<double, std::milli>(now - job.startTime).count();
+				if (runningMs < getSpeculationThresholdMs(job.bits))
+					continue;
+
+				// only worth it if there is a slave node idle right now, and this request doesn't have too many copies already
+				auto copies = std::count_if(jobs.begin(), jobs.end(), [&job](const Job& other) {
+					return other.clientId == job.clientId && other.requestId == job.requestId && !other.done && !other.cancelled;
+				}) + std::count_if(backupJobs.begin(), backupJobs.end(), [&job](const Job& other) {
+					return other.clientId == job.clientId && other.requestId == job.requestId;
+				});
+				// jobs still waiting for a slave node, backups queued earlier included, get the free
+				// slots first; a backup only goes ahead if one is left over for it
+				auto waiting = (int) backupJobs.size() + (int) std::count_if(jobs.begin(), jobs.end(), [](const Job& other) {
+					return other.slaveNodeId == -1 && !other.done && !other.cancelled;
+				});
+				std::vector<int> candidates;
+				int spareSlots = -waiting;
+				for (auto& slots : getFreeSlots()) {
+					if (slots.first == slaveNodeId)
+						continue;
+					candidates.push_back(slots.first);
+					spareSlots += slots.second;
+				}
+				if (copies >= maxJobsPerClientReq || spareSlots <= 0 || pickSlaveNode(candidates, job.bits) == -1)
+					continue;
+
+				job.backupLaunched = true;
+				backupJobs.push_back(makeJob(job, false));
+				LOG(logger, INFO, "JMD :: job (clientId=" + std::to_string(clientId) + ", numberToFactorize=" + numberToFactorize + ") on slave node " + std::to_string(slaveNodeId) + " has run " + std::to_string((long) runningMs) + "ms. Launching a backup copy with seed " + std::to_string(backupJobs.back().seed));
 			}
 		}
+
+		// remove jobs that are complete, or cancelled before any slave node started them
+		jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](const Job& job) {
+			return job.done || (job.cancelled && job.slaveNodeId == -1);
+		}), jobs.end());
+
+		// backups get a slave node on the next pass
+		jobs.insert(jobs.end(), backupJobs.begin(), backupJobs.end());
+		jobsMutex.unlock();
+
+		// every job of these dead slave nodes has been reset now, so their connections can be released
+		slavesMutex.lock();
+		for (auto deadSlaveNodeId : deadSlaveNodeIds)
+			deadSlaveConns.erase(std::remove(deadSlaveConns.begin(), deadSlaveConns.end(), deadSlaveNodeId), deadSlaveConns.end());
+		slavesMutex.unlock();
+
+		for (auto& job : dispatchedJobs)
+			Trace::get().record(tr_job_dispatched, job.clientId, job.requestId, job.seed, job.slaveNodeId);
+		for (auto& messages : messagesToSend)
+			sendMessages(messages.first, messages.second);
+
+		if (!expiredJobs.empty()) {
+			completedJobsMutex.lock();
+			for (auto& expiredJob : expiredJobs)
+				completedJobs.push(expiredJob);
+			completedJobsMutex.unlock();
+			completedJobsCv.notify_one();
+			partialResults.add(expiredJobs.size());
+		}
+
+		if (!tooWideJobs.empty()) {
+			completedJobsMutex.lock();
+			for (auto& tooWideJob : tooWideJobs)
+				completedJobs.push(tooWideJob);
+			completedJobsMutex.unlock();
+			completedJobsCv.notify_one();
+		}
+
 		std::this_thread::sleep_for(std::chrono::milliseconds(100)); // sleep thread
 	}
 }
 
 void TCPServer::cjd() {
 	while (true) {
-		if (!completedJobs.empty()) {
-			auto completedJob = completedJobs.front();
-			completedJobs.pop();
+		// wait for completed jobs, then take everything queued so far in one go
+		std::queue<std::tuple<int, int, std::string, std::string, std::string, std::string>> batch;
+		{
+			std::unique_lock<std::mutex> lock(completedJobsMutex);
+			completedJobsCv.wait_for(lock, std::chrono::milliseconds(100), [this] { return !completedJobs.empty(); });
+			if (completedJobs.empty() || !mainServerAlive)
+				continue; // leave jobs queued for resending once the main server is back
+			std::swap(batch, completedJobs);
+		}
+
+		// one newline separated write for the whole batch
+		std::string messageToSend;
+		std::vector<std::pair<int, int>> sentRequests; // (clientId, requestId), for the trace
+		auto batchSize = batch.size();
+		while (!batch.empty()) {
+			auto completedJob = batch.front();
+			batch.pop();
 
 			auto clientId = std::get<0>(completedJob);
-			auto numberToFactorize = std::get<1>(completedJob);
-			auto primes = std::get<2>(completedJob);
+			auto requestId = std::get<1>(completedJob);
+			auto numberToFactorize = std::get<2>(completedJob);
+			auto primes = std::get<3>(completedJob);
+			auto unfactored = std::get<4>(completedJob);
+			auto error = std::get<5>(completedJob);
+
+			if (!messageToSend.empty())
+				messageToSend += "\n";
+			if (!error.empty())
+				messageToSend += "FACTOR_ERR|" + std::to_string(clientId) + "|" + std::to_string(requestId) + "|" + numberToFactorize + "|" + error;
+			else {
+				messageToSend += "FACTOR_RESP|" + std::to_string(clientId) + "|" + std::to_string(requestId) + "|" + numberToFactorize + "|" + primes;
+				if (!unfactored.empty())
+					messageToSend += "|" + unfactored;
+			}
+			sentRequests.push_back(std::make_pair(clientId, requestId));
+		}
+
+		for (auto& request : sentRequests)
+			Trace::get().record(tr_coord_response_sent, request.first, request.second);
+		sendMessage(mainServerConnId, messageToSend);
+		responsesSent.add(batchSize);
+		LOG(logger, INFO, "CJD:: sent " + std::to_string(batchSize) + " message(s) to main server: " + messageToSend);
+	}
+}
 
-			auto messageToSend = "FACTOR_RESP|" + clientId + "|" + numberToFactorize + "|" + primes;
 
-			if (mainServerAlive) {
-				sendMessage(mainServerConnId, messageToSend);
-				log("INFO: CJD:: sent message to main server: " + messageToSend);
-			} else {
-				completedJobs.push(completedJob); // add job back to queue for resending
+/**********************************************************************************************
+* health monitor daemon
+* - sends every slave node a HEARTBEAT|sentTimeMs each heartbeatIntervalMs; slave nodes echo it
+*   back as HEARTBEAT_RESP|sentTimeMs, which keeps their round trip average up to date
+* - slave nodes we haven't heard anything from in heartbeatTimeoutMs are marked dead and their
+*   connection shut down, so jmd reassigns their jobs
+* - when a slave node's round trip average climbs above slowSlaveRttMs, or its slowdown average
+*   above slowSlaveSlowdown, its jobs are reassigned. Heartbeats are answered even while every
+*   core is busy, so the slowdown is what shows a slave node whose factoring has stalled: its
+*   running jobs count as if they finished now, once they are already later than the average
+***********************************************************************************************/
+void TCPServer::hmd() {
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		std::vector<int> aliveSlaveNodeIds;
+		std::vector<int> silentSlaveNodeIds;
+		std::vector<int> newlySlowSlaveNodeIds;
+
+		// slowdown of each slave node's longest running job so far
+		std::map<int, double> runningSlowdowns;
+		jobsMutex.lock();
+		for (auto& job : jobs) {
+			if (job.slaveNodeId == -1 || job.done || job.cancelled)
+				continue;
+			double typicalSeconds = getTypicalSeconds(job.bits);
+			if (typicalSeconds <= 0)
+				continue;
+			double slowdown = std::chrono::duration<double>(now - job.startTime).count() / typicalSeconds;
+			auto& worst = runningSlowdowns[job.slaveNodeId];
+			worst = std::max(worst, slowdown);
+		}
+		jobsMutex.unlock();
+
+		slavesMutex.lock();
+		for (auto& entry : slaveNodes) {
+			auto& slaveNode = entry.second;
+			auto silentForMs = std::chrono::duration_cast<std::chrono::milliseconds>(now - slaveNode.lastSeen).count();
+
+			if (silentForMs > heartbeatTimeoutMs) {
+				silentSlaveNodeIds.push_back(entry.first);
+				continue;
 			}
+			aliveSlaveNodeIds.push_back(entry.first);
+
+			double slowdown = slaveNode.slowdownEwma;
+			auto running = runningSlowdowns.find(entry.first);
+			if (running != runningSlowdowns.end() && running->second > slowdown)
+				slowdown = ewma(slowdown, running->second, slaveNode.slowdownSamples);
+
+			bool slow = (slaveNode.heartbeatsAnswered > 0 && slaveNode.rttEwmaMs > slowSlaveRttMs) || slowdown > slowSlaveSlowdown;
+			if (slow && !slaveNode.slow)
+				newlySlowSlaveNodeIds.push_back(entry.first);
+			slaveNode.slow = slow;
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(100)); // sleep thread
+		slavesMutex.unlock();
+
+		auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+		auto heartbeat = "HEARTBEAT|" + std::to_string(nowMs);
+		for (auto slaveNodeId : aliveSlaveNodeIds)
+			sendMessage(slaveNodeId, heartbeat);
+
+		for (auto slaveNodeId : silentSlaveNodeIds) {
+			LOG(logger, WARN, "HMD :: no message from slave node " + std::to_string(slaveNodeId) + " in " + std::to_string(heartbeatTimeoutMs) + "ms. Marking it dead.");
+			markSlaveConnAsDead(slaveNodeId);
+			::shutdown(slaveNodeId, SHUT_RDWR); // wakes up the slave node's client thread so it can exit
+		}
+
+		for (auto slaveNodeId : newlySlowSlaveNodeIds)
+			reassignSlaveNodeJobs(slaveNodeId);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(heartbeatIntervalMs)); // sleep thread
 	}
 }
 
+/**********************************************************************************************
+ * startMetrics - serves the metrics registry over HTTP on ip_addr:port, with this coordinator's
+ *                queue depths and slave node utilization added
+ *
+ *    Returns: false if the port can't be bound
+ **********************************************************************************************/
+bool TCPServer::startMetrics(const char *ip_addr, unsigned short port) {
+	Metrics::get().addCollector([this](std::string& out) { collectMetrics(out); });
+	return Metrics::get().serve(ip_addr, port);
+}
+
+/*
+	collectMetrics - appends the values that are read off the coordinator's state: jobs waiting
+	for a slave node and running, responses waiting for cjd, and how busy each slave node has been
+	since it registered (finished jobs plus the ones it's on now, over all its cores).
+*/
+void TCPServer::collectMetrics(std::string& out) {
+	auto now = std::chrono::steady_clock::now();
+	int pending = 0, inFlight = 0;
+	std::map<int, double> runningSeconds; // slave node id -> time on its current jobs
+
+	jobsMutex.lock();
+	for (auto& job : jobs) {
+		if (job.done || job.cancelled)
+			continue;
+		if (job.slaveNodeId == -1) {
+			pending++;
+		} else {
+			inFlight++;
+			runningSeconds[job.slaveNodeId] += std::chrono::duration<double>(now - job.startTime).count();
+		}
+	}
+	jobsMutex.unlock();
+
+	completedJobsMutex.lock();
+	auto completedQueued = completedJobs.size();
+	completedJobsMutex.unlock();
+
+	Metrics::appendHelp(out, "coordinator_jobs_pending", "jobs waiting for a slave node");
+	Metrics::appendLine(out, "coordinator_jobs_pending", pending);
+	Metrics::appendHelp(out, "coordinator_jobs_in_flight", "jobs running on a slave node");
+	Metrics::appendLine(out, "coordinator_jobs_in_flight", inFlight);
+	Metrics::appendHelp(out, "coordinator_completed_queue_depth", "answers waiting to be sent to the main server");
+	Metrics::appendLine(out, "coordinator_completed_queue_depth", completedQueued);
+
+	std::lock_guard<std::mutex> lock(slavesMutex);
+	Metrics::appendHelp(out, "coordinator_slaves_connected", "slave nodes connected");
+	Metrics::appendLine(out, "coordinator_slaves_connected", slaveNodes.size());
+	Metrics::appendHelp(out, "coordinator_slave_busy_ratio", "fraction of the time since it registered that each slave node spent on jobs");
+	for (auto& entry : slaveNodes) {
+		auto& slaveNode = entry.second;
+		double upSeconds = std::chrono::duration<double>(now - slaveNode.connectedAt).count() * std::max(1, slaveNode.cores);
+		double busy = slaveNode.busySeconds + runningSeconds[entry.first];
+		std::string slave = "{slave=\"" + std::to_string(entry.first) + "\"}";
+		Metrics::appendLine(out, "coordinator_slave_busy_ratio" + slave, upSeconds > 0 ? std::min(1.0, busy / upSeconds) : 0);
+		Metrics::appendLine(out, "coordinator_slave_jobs_completed" + slave, slaveNode.jobsCompleted);
+		Metrics::appendLine(out, "coordinator_slave_rtt_ms" + slave, slaveNode.rttEwmaMs);
+		Metrics::appendLine(out, "coordinator_slave_slowdown" + slave, slaveNode.slowdownEwma);
+	}
+}
 
 /**********************************************************************************************
  * shutdown - Cleanly closes the socket FD.
@@ -543,9 +1340,10 @@ void TCPServer::cjd() {
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 void TCPServer::shutdown() {
-	log("Shutting down server");
+	LOG(logger, INFO, "Shutting down server");
 
 	// close all client sockets
+	std::lock_guard<std::mutex> lock(slavesMutex);
 	for(int slaveConn : this->slaveConns)
 		close(slaveConn);
 
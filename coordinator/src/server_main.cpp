@@ -15,26 +15,41 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " [-p <portnum>] [-a <ip_addr>]\n";
+   std::cout << execname << " [-p <portnum>] [-a <ip_addr>] [-i <heartbeat_ms>] [-t <timeout_ms>] [-r <slow_rtt_ms>] [-l <log_file>] [-T <trace_file>] [-M <metrics_port>]\n";
    std::cout << "   p: the port to bind the server to\n";
    std::cout << "   a: the IP address to bind the server\n";
+   std::cout << "   i: how often (ms) to send each slave node a heartbeat\n";
+   std::cout << "   t: how long (ms) a slave node may stay silent before its jobs are reassigned\n";
+   std::cout << "   r: heartbeat round trip (ms) above which a slave node's job is reassigned\n";
+   std::cout << "   l: the file to log to (default server_<portnum>.log, so each coordinator has its own)\n";
+   std::cout << "   T: record a binary event trace of every job to this file (see tracemerge)\n";
+   std::cout << "   M: serve metrics over HTTP on this port (e.g. curl http://127.0.0.1:<port>/metrics)\n";
 
 }
 
 // global default values
 const unsigned short default_port = 9999;
 const char default_IP[] = "127.0.0.1";
+const int default_heartbeat_interval = 1000;
+const int default_heartbeat_timeout = 5000;
+const int default_slow_rtt = 2000;
 
 int main(int argc, char *argv[]) {
 
 
    unsigned short port = default_port;
    std::string ip_addr(default_IP);
+   int heartbeat_interval = default_heartbeat_interval;
+   int heartbeat_timeout = default_heartbeat_timeout;
+   int slow_rtt = default_slow_rtt;
+   std::string log_file; // server_<port>.log unless given
+   std::string trace_file;
+   long metrics_port = 0;
 
    // Get the command line arguments and set params appropriately
    int c = 0;
    long portval;
-   while ((c = getopt(argc, argv, "p:a:smw")) != -1) {
+   while ((c = getopt(argc, argv, "p:a:i:t:r:l:T:M:smw")) != -1) {
       switch (c) {
   
       // Set the max number to count up to	    
@@ -53,6 +68,35 @@ int main(int argc, char *argv[]) {
          ip_addr = optarg; 
          break;
 
+      // Slave node health tracking
+      case 'i':
+         heartbeat_interval = strtol(optarg, NULL, 10);
+         break;
+
+      case 't':
+         heartbeat_timeout = strtol(optarg, NULL, 10);
+         break;
+
+      case 'r':
+         slow_rtt = strtol(optarg, NULL, 10);
+         break;
+
+      case 'l':
+         log_file = optarg;
+         break;
+
+      case 'T':
+         trace_file = optarg;
+         break;
+
+      case 'M':
+         metrics_port = strtol(optarg, NULL, 10);
+         if ((metrics_port < 1) || (metrics_port > 65535)) {
+            std::cout << "Invalid metrics port. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         break;
+
       case '?':
 	      displayHelp(argv[0]);
 	      break;
@@ -67,6 +111,20 @@ int main(int argc, char *argv[]) {
 
    // Try to set up the server for listening
    TCPServer server;
+   if ((heartbeat_interval < 1) || (heartbeat_timeout <= heartbeat_interval) || (slow_rtt < 1)) {
+      std::cout << "Invalid heartbeat settings. The timeout must be longer than the interval.\n";
+      displayHelp(argv[0]);
+      exit(0);
+   }
+   server.setHeartbeatTimeouts(heartbeat_interval, heartbeat_timeout, slow_rtt);
+   if (log_file.empty())
+      log_file = "server_" + std::to_string(port) + ".log";
+   server.setLogFile(log_file);
+   if (trace_file.length() > 0)
+      Trace::get().open(trace_file, tc_coordinator);
+   if (metrics_port > 0)
+      server.startMetrics(ip_addr.c_str(), (unsigned short) metrics_port);
+
    try {
       cout << "Binding server to " << ip_addr << " port " << port << endl;
       server.bindSvr(ip_addr.c_str(), port);
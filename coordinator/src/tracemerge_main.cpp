@@ -0,0 +1,262 @@
+/****************************************************************************************
+ * tracemerge - merges the binary event traces written with -T by the main server, the
+ *              coordinator(s) and the slaves, follows each request through them and prints
+ *              how long it spent in each stage, as latency histograms, followed by the
+ *              slowest requests broken down by stage
+ *
+ *              All traces must come from processes on the same host; timestamps are
+ *              CLOCK_MONOTONIC and aren't comparable between hosts
+ *
+ ****************************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <getopt.h>
+#include "Trace.h"
+
+using namespace std;
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-n <slowest>] <trace_file> [<trace_file> ...]\n";
+   std::cout << "   n: how many of the slowest requests to break down (default 5)\n";
+}
+
+// The stages a request goes through, each measured from one event to the next
+enum stage { st_to_coordinator, st_coordinator_queue, st_to_slave, st_first_divisor, st_factoring,
+             st_to_coordinator_resp, st_completed_queue, st_to_client, st_total, st_count };
+
+const char *stage_names[st_count] = {
+   "main server -> coordinator",
+   "waiting for a slave",
+   "coordinator -> slave",
+   "slave: first divisor",
+   "slave: factoring",
+   "slave -> coordinator",
+   "waiting to be sent back",
+   "coordinator -> client",
+   "total",
+};
+
+// When a request reached each event. 0 means not seen
+struct Timeline {
+   uint64_t received = 0, created = 0, dispatched = 0, slaveStart = 0, firstDivisor = 0,
+            slaveDone = 0, resultReceived = 0, coordSent = 0, responseSent = 0;
+   uint64_t winningSeed = 0;
+};
+
+// What happened to one copy of a job (one seed) on its slave
+struct SeedTimes {
+   uint64_t dispatched = 0, slaveStart = 0, firstDivisor = 0, slaveDone = 0;
+};
+
+/*****************************************************************************************
+ * readTrace - appends every record in a trace file to records
+ *
+ *    Returns: false if the file can't be read
+ *****************************************************************************************/
+
+bool readTrace(const char *filename, std::vector<TraceRecord> &records) {
+   std::ifstream in(filename, std::ios::binary);
+   if (!in)
+      return false;
+
+   TraceRecord rec;
+   while (in.read((char *) &rec, sizeof(rec)))
+      records.push_back(rec);
+   return true;
+}
+
+/*****************************************************************************************
+ * span - time from start to end in microseconds, or -1 if either wasn't seen
+ *****************************************************************************************/
+
+double span(uint64_t start, uint64_t end) {
+   if (start == 0 || end == 0 || end < start)
+      return -1;
+   return (end - start) / 1000.0;
+}
+
+/*****************************************************************************************
+ * stageTimes - the time (us) a request spent in each stage, -1 for stages not seen
+ *****************************************************************************************/
+
+std::vector<double> stageTimes(const Timeline &t) {
+   std::vector<double> times(st_count);
+   times[st_to_coordinator] = span(t.received, t.created);
+   times[st_coordinator_queue] = span(t.created, t.dispatched);
+   times[st_to_slave] = span(t.dispatched, t.slaveStart);
+   times[st_first_divisor] = span(t.slaveStart, t.firstDivisor);
+   times[st_factoring] = span(t.slaveStart, t.slaveDone);
+   times[st_to_coordinator_resp] = span(t.slaveDone, t.resultReceived);
+   times[st_completed_queue] = span(t.resultReceived, t.coordSent);
+   times[st_to_client] = span(t.coordSent, t.responseSent);
+   times[st_total] = span(t.received, t.responseSent);
+   return times;
+}
+
+/*****************************************************************************************
+ * printHistogram - prints the percentiles of one stage's times and a histogram with a
+ *                  bucket per power of two microseconds
+ *****************************************************************************************/
+
+void printHistogram(const char *name, std::vector<double> &times) {
+   cout << name << ": ";
+   if (times.empty()) {
+      cout << "no samples\n\n";
+      return;
+   }
+   std::sort(times.begin(), times.end());
+   auto pct = [&times](double p) { return times[(size_t) (p * (times.size() - 1))]; };
+   cout << std::fixed << std::setprecision(1) << times.size() << " samples, min " << times.front()
+        << "us, p50 " << pct(0.5) << "us, p90 " << pct(0.9) << "us, p99 " << pct(0.99)
+        << "us, max " << times.back() << "us\n";
+
+   std::map<int, size_t> buckets;
+   size_t largest = 0;
+   for (double us : times) {
+      int bucket = 0;
+      while ((1ull << bucket) <= us)
+         bucket++;
+      largest = std::max(largest, ++buckets[bucket]);
+   }
+
+   const int width = 50;
+   for (auto &bucket : buckets) {
+      uint64_t upper = 1ull << bucket.first;
+      cout << "   < " << std::setw(10) << upper << "us " << std::setw(7) << bucket.second << " "
+           << std::string((bucket.second * width + largest - 1) / largest, '#') << "\n";
+   }
+   cout << "\n";
+}
+
+int main(int argc, char *argv[]) {
+   int slowest = 5;
+   int c = 0;
+   while ((c = getopt(argc, argv, "n:")) != -1) {
+      switch (c) {
+      case 'n':
+         slowest = strtol(optarg, NULL, 10);
+         break;
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
+   if (optind >= argc) {
+      displayHelp(argv[0]);
+      exit(0);
+   }
+
+   std::vector<TraceRecord> records;
+   for (int i = optind; i < argc; i++) {
+      if (!readTrace(argv[i], records)) {
+         cerr << "Could not read trace file " << argv[i] << "\n";
+         return -1;
+      }
+   }
+   std::stable_sort(records.begin(), records.end(), [](const TraceRecord &a, const TraceRecord &b) {
+      return a.timeNs < b.timeNs;
+   });
+
+   // Requests are keyed by (clientId, requestId); slaves only know the seed of the copy they
+   // ran, which the coordinator's job events tie back to the request
+   std::map<std::pair<int, int>, Timeline> requests;
+   std::unordered_map<uint64_t, SeedTimes> seeds;
+   for (const TraceRecord &rec : records) {
+      auto key = std::make_pair(rec.clientId, rec.requestId);
+      switch (rec.event) {
+      case tr_request_received:
+         requests[key].received = rec.timeNs;
+         break;
+      case tr_job_created:
+         if (requests[key].created == 0)
+            requests[key].created = rec.timeNs;
+         break;
+      case tr_job_dispatched:
+         if (requests[key].dispatched == 0)
+            requests[key].dispatched = rec.timeNs;
+         if (seeds[rec.seed].slaveDone == 0)
+            seeds[rec.seed].dispatched = rec.timeNs;
+         break;
+      case tr_slave_start:
+         if (seeds[rec.seed].slaveDone == 0) {
+            seeds[rec.seed].slaveStart = rec.timeNs;
+            seeds[rec.seed].firstDivisor = 0;
+         }
+         break;
+      case tr_divisor_found:
+         if (seeds[rec.seed].firstDivisor == 0)
+            seeds[rec.seed].firstDivisor = rec.timeNs;
+         break;
+      case tr_slave_done:
+         if (seeds[rec.seed].slaveDone == 0)
+            seeds[rec.seed].slaveDone = rec.timeNs;
+         break;
+      case tr_result_received:
+         if (requests[key].resultReceived == 0) {
+            requests[key].resultReceived = rec.timeNs;
+            requests[key].winningSeed = rec.seed;
+         }
+         break;
+      case tr_coord_response_sent:
+         requests[key].coordSent = rec.timeNs;
+         break;
+      case tr_response_sent:
+         requests[key].responseSent = rec.timeNs;
+         break;
+      default:
+         break;
+      }
+   }
+
+   // The slave side of a request is the copy that answered first
+   for (auto &request : requests) {
+      Timeline &t = request.second;
+      auto seed = seeds.find(t.winningSeed);
+      if (t.winningSeed == 0 || seed == seeds.end())
+         continue;
+      if (seed->second.dispatched != 0)
+         t.dispatched = seed->second.dispatched;
+      t.slaveStart = seed->second.slaveStart;
+      t.firstDivisor = seed->second.firstDivisor;
+      t.slaveDone = seed->second.slaveDone;
+   }
+
+   std::vector<std::vector<double>> samples(st_count);
+   std::vector<std::pair<double, std::pair<int, int>>> totals;
+   for (auto &request : requests) {
+      auto times = stageTimes(request.second);
+      for (int s = 0; s < st_count; s++)
+         if (times[s] >= 0)
+            samples[s].push_back(times[s]);
+      if (times[st_total] >= 0)
+         totals.push_back(std::make_pair(times[st_total], request.first));
+   }
+
+   cout << records.size() << " events, " << requests.size() << " requests, " << totals.size() << " complete\n\n";
+   for (int s = 0; s < st_count; s++)
+      printHistogram(stage_names[s], samples[s]);
+
+   // Where the slowest requests spent their time
+   std::sort(totals.rbegin(), totals.rend());
+   if ((int) totals.size() > slowest)
+      totals.resize(slowest);
+   if (totals.size() > 0)
+      cout << "Slowest requests (us):\n";
+   for (auto &total : totals) {
+      auto times = stageTimes(requests[total.second]);
+      cout << "client " << total.second.first << " request " << total.second.second << ": " << times[st_total] << "\n";
+      for (int s = 0; s < st_total; s++)
+         if (times[s] >= 0)
+            cout << "   " << std::left << std::setw(28) << stage_names[s] << std::right << times[s] << "\n";
+   }
+
+   return 0;
+}
@@ -4,9 +4,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
 #include <vector>
+#include <deque>
+#include <string>
 #include <unistd.h>
 #include "exceptions.h"
+#include "RingBuffer.h"
 
 // Manages File Descriptors by largely simplfying their interfaces for specific purposes.
 // FileDesc provides some limited functionality and could be instantiated, but child
@@ -15,6 +19,7 @@
 // SocketFD - Network socket FD with stored IP/port information in sockaddr_in
 // TermFD - Stdin terminal
 // FileFD - non-buffered file FD with ability to write/read binary data
+// EpollFD - epoll instance that waits on many other FDs at once
 
 class FileDesc
 {
@@ -32,6 +37,7 @@ public:
 
    // Basic read function to read all string data off the FD
    ssize_t readFD(std::string &buf);
+   ssize_t readFD(RingBuffer &buf);
 
    // Reads one character from the buffer at a time until it finds a newline
    ssize_t readStr(std::string &buf);
@@ -76,13 +82,13 @@ public:
       int results;
       if ((results = read(_fd, bytebuf, bufsize)) < 0)
       {
-         delete bytebuf;
+         delete[] bytebuf;
          return -1;
       }
 
       if (results < bufsize) {
          if (results % datasize != 0) {
-            delete bytebuf;
+            delete[] bytebuf;
             return -2;
          }
       }
@@ -93,7 +99,7 @@ public:
          buf.push_back((T) bytebuf[i*datasize]);
       }
 
-      delete bytebuf;
+      delete[] bytebuf;
       return buf.size();
    }
 
@@ -120,7 +126,7 @@ public:
 
       int results;
       results = write(_fd, bytebuf, bufsize);
-      delete bytebuf;
+      delete[] bytebuf;
       return results;
 
    }
@@ -147,6 +153,13 @@ public:
    bool connectTo(const char *ip_addr, unsigned short port);
    void listenFD(int backlog = 5);
    bool acceptFD(SocketFD &server);
+   void setReusePort();
+
+   // Output queue: messages are queued, then flushed together with one sendmsg
+   void queueFD(std::string data);
+   ssize_t flushFD();
+   bool hasPending() { return !_outq.empty(); };
+   size_t pendingBytes() { return _outBytes; };
 
    unsigned long getIPAddr();
    void getIPAddrStr(std::string &buf);
@@ -156,6 +169,11 @@ private:
 
    sockaddr_in _fd_addr;
 
+   // Messages not yet written; _outOffset bytes of the front one are already gone
+   std::deque<std::string> _outq;
+   size_t _outOffset = 0;
+   size_t _outBytes = 0;
+
 };
 
 /********************************************************************************************
@@ -194,4 +212,23 @@ private:
 };
 
 
+/********************************************************************************************
+ * EpollFD class - an epoll instance. FDs are registered with the events to wait for and
+ *                 waitFD returns only the ones that are ready, each tagged with its FD
+ *
+ ********************************************************************************************/
+
+class EpollFD : public FileDesc {
+public:
+   EpollFD();
+   ~EpollFD();
+
+   void addFD(int fd, uint32_t events);
+   void removeFD(int fd);
+   int waitFD(std::vector<struct epoll_event> &events, int ms_timeout = -1);
+
+private:
+
+};
+
 #endif
@@ -0,0 +1,40 @@
+#ifndef HASHRING_H
+#define HASHRING_H
+
+#include <map>
+#include <string>
+#include <cstdint>
+
+/******************************************************************************************
+ * HashRing - consistent hash ring used to shard numbers across coordinators. Each node is
+ *            placed on the ring at several points (virtual nodes) so keys spread evenly, and
+ *            removing a node only moves the keys that were on it.
+ *
+ *  	   addNode - places node (an index the caller understands) on the ring, using name
+ *  	             (e.g. "127.0.0.1:9999") to pick its points
+ *  	   removeNode - takes node off the ring
+ *  	   getNode - the node that owns key, or -1 if the ring is empty
+ *
+ *****************************************************************************************/
+
+class HashRing {
+public:
+   HashRing(unsigned int virtualNodes = 100);
+   ~HashRing();
+
+   void addNode(int node, const std::string &name);
+   void removeNode(int node);
+   int getNode(const std::string &key) const;
+
+   bool empty() const { return _ring.empty(); };
+
+private:
+   static uint64_t hash(const std::string &key);
+
+   unsigned int _virtualNodes;
+
+   // point on the ring -> node
+   std::map<uint64_t, int> _ring;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+ * Log levels. Lines below LOG_LEVEL are compiled out, message building included: build with
+ * -DLOG_LEVEL=LOG_LEVEL_INFO to drop DEBUG lines, or LOG_LEVEL_WARN to keep only warnings.
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/*
+ * LOG(logger, level, msg) - logs msg prefixed with its level, e.g. LOG(logger, WARN, "x") writes
+ * "WARN: x". level is one of DEBUG, INFO or WARN.
+ */
+#define LOG(logger, level, msg) \
+	do { \
+		if (LOG_LEVEL_##level >= LOG_LEVEL) \
+			(logger).log(std::string(#level ": ") + (msg)); \
+	} while (0)
+
+/*
+ * Logger - Manages log file generation
+ *
+ * Lines are timestamped on the calling thread and put on a lock-free queue; a writer thread
+ * takes them off in batches and appends each batch to the log file with a single write. The log
+ * file stays open for the life of the Logger. Safe to call from any number of threads.
+ */
+
+class Logger {
+	public:
+		Logger();
+		~Logger();
+
+		void log(const char *msg);
+		void log(std::string msg);
+		void setLogFileName(std::string fileName);
+	private:
+		// one slot of the queue; seq says whether it's free for a producer or full for the writer
+		struct Slot {
+			std::atomic<size_t> seq;
+			std::string line;
+		};
+
+		static const size_t queueSize = 8192; // power of two
+		static const size_t maxBatchLines = 1024; // most lines gathered into one write
+		static const int idleSleepMs = 5; // how long the writer sleeps when there is nothing to write
+
+		std::unique_ptr<Slot[]> slots;
+		std::atomic<size_t> enqueuePos{0};
+		size_t dequeuePos = 0; // only the writer thread touches this
+
+		std::string logFileName = "server.log";
+		std::mutex fileNameMutex; // guards logFileName; the writer reopens the file when it changes
+		std::atomic<bool> reopen{true};
+		int logFd = -1;
+
+		std::atomic<bool> running{true};
+		std::thread writer;
+
+		bool enqueue(std::string& line);
+		bool dequeue(std::string& line);
+		void writerThread();
+		void openLogFile();
+		void writeAll(const std::string& data);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <memory>
+#include <string_view>
+#include <sys/types.h>
+
+/******************************************************************************************
+ * RingBuffer - fixed size receive buffer for a socket. Memory is allocated once; readFrom
+ *              reads straight into the free space with readv (two pieces when it wraps), and
+ *              nextLine hands out complete newline terminated frames as string_views. A
+ *              partial frame stays in the buffer until the rest of it arrives.
+ *
+ *  	   readFrom - reads whatever fits from fd; same return values as read
+ *  	   nextLine - the next complete line (without its newline), consumed from the buffer.
+ *  	              The view is only valid until the next readFrom
+ *  	   full - no space left and no complete line: the frame is longer than the buffer
+ *  	   clear - drops everything buffered
+ *
+ *****************************************************************************************/
+
+class RingBuffer {
+public:
+   RingBuffer(size_t capacity = 8192);
+   ~RingBuffer();
+
+   RingBuffer(const RingBuffer &) = delete;
+   RingBuffer &operator=(const RingBuffer &) = delete;
+
+   ssize_t readFrom(int fd);
+   bool nextLine(std::string_view &line);
+
+   size_t size() const { return _tail - _head; };
+   size_t space() const { return _capacity - size(); };
+   bool full() const { return space() == 0; };
+   void clear();
+
+private:
+   size_t _capacity;
+   size_t _mask;
+   std::unique_ptr<char[]> _buf;
+
+   // Frames that wrap around the end are copied here so they can be handed out in one piece
+   std::unique_ptr<char[]> _frame;
+
+   // Positions only ever grow; the index into _buf is position & _mask
+   size_t _head = 0;    // next byte to hand out
+   size_t _tail = 0;    // next byte to fill
+   size_t _scanned = 0; // bytes after _head already known not to hold a newline
+};
+
+#endif
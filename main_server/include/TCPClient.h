@@ -17,13 +17,13 @@ public:
 
    virtual void connectTo(const char *ip_addr, unsigned short port);
    virtual void handleConnection();
+   void uploadFile(const char *filename);
 
    virtual void closeConn();
 
 private:
    int readStdin();
 
-   bool blockUserInput = false;
    int uniqueId = 0;
 
    // Stores the user's typing
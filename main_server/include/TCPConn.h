@@ -1,10 +1,28 @@
 #ifndef TCPCONN_H
 #define TCPCONN_H
 
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
 #include "FileDesc.h"
 
 const int max_attempts = 2;
 
+// Size of each client's input buffer; longer lines are discarded
+const size_t client_bufsize = 8192;
+
+// Most output a client may leave unread before it is dropped
+const size_t client_max_pending = 1 << 20;
+
+// A number a client asked to factor, tagged with the id its response will carry
+struct FactorRequest {
+   int requestId;
+   std::string number;
+   unsigned long budgetMs = 0;          // answer with what's found by then, 0 for no limit
+   unsigned long budgetIterations = 0;  // or after this many iterations, 0 for no limit
+};
+
 // Methods and attributes to manage a network connection, including tracking the username
 // and a buffer for user input. Status tracks what "phase" of login the user is currently in
 class TCPConn 
@@ -18,10 +36,18 @@ public:
 
    int sendText(const char *msg);
    int sendText(const char *msg, int size);
+   void queueText(std::string msg);
+   int flush();
 
-   std::string handleConnection();
+   std::vector<FactorRequest> handleConnection();
    void sendMenu();
-   std::string getMenuChoice();
+   void getMenuChoice(std::string cmd, std::vector<FactorRequest> &requests);
+   void getBatch(std::string numbers, std::vector<FactorRequest> &requests);
+   void getUploadLine(std::string cmd, std::vector<FactorRequest> &requests);
+   void setBudget(std::string args);
+   FactorRequest newRequest(const std::string &number);
+   void requestsAnswered(const std::vector<int> &requestIds);
+   size_t pendingRequests();
    bool isNum(const std::string& s);
 
    
@@ -31,25 +57,49 @@ public:
    bool isConnected();
 
    unsigned long getIPAddr() { return _connfd.getIPAddr(); };
+   int getFD() { return _connfd.getFD(); };
+   void setNonBlocking() { _connfd.setNonBlocking(); };
    void getIPAddrStr(std::string &buf);
 
    //jb add
-   std::string id;
+   int id = -1;
    void log(std::string &msg);
 
 private:
 
 
-   enum statustype { s_menu };
+   enum statustype { s_menu, s_upload };
 
    statustype _status = s_menu;
 
    SocketFD _connfd;
    SocketFD _connfdcoord;
+
+   // Responses are sent from the coordinator thread while the client's worker may be writing
+   // to or closing the same socket. Also guards the socket's output queue
+   std::mutex _sendMutex;
  
-   std::string _inputbuf;
+   RingBuffer _inputbuf{client_bufsize};
+   bool _discardLine = false;
    std::string _inputbufcoord;
 
+   // Requests are numbered from 1 in the order the client sends them
+   int _nextRequestId = 1;
+
+   // Budget given to every request from now on, set with the "budget" command
+   unsigned long _budgetMs = 0;
+   unsigned long _budgetIterations = 0;
+
+   // Upload mode: numbers taken so far, the first one's request id, and lines rejected
+   int _uploadCount = 0;
+   int _uploadFirstId = 0;
+   int _uploadRejected = 0;
+
+   // When each unanswered request was made, for the latency metric. Requests are made on the
+   // client's worker and answered on the coordinator thread
+   std::unordered_map<int, std::chrono::steady_clock::time_point> _requestTimes;
+   std::mutex _requestTimesMutex;
+
 
 
 };
@@ -1,12 +1,34 @@
 #ifndef TCPSERVER_H
 #define TCPSERVER_H
 
-#include <list>
 #include <memory>
 #include <map>
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include "Server.h"
 #include "FileDesc.h"
 #include "TCPConn.h"
+#include "HashRing.h"
+#include "Trace.h"
+#include "Metrics.h"
+
+// A client handling thread: its own listening socket (sharing the port with the other workers
+// through SO_REUSEPORT, so the kernel spreads new connections across them) and its own event
+// loop over the clients it accepted
+struct Worker {
+   SocketFD listenfd;
+   EpollFD epoll;
+   std::thread thread;
+};
+
+// Coordinator responses gathered for one client: the text to send and the requests it answers
+struct ClientResponses {
+   std::string text;
+   std::vector<int> requestIds;
+};
 
 class TCPServer : public Server 
 {
@@ -14,23 +36,58 @@ public:
    TCPServer();
    ~TCPServer();
 
+   void setWorkers(int workers) { numWorkers = workers; };
    void bindSvr(const char *ip_addr, unsigned short port);
    void connectToCoordinator(const char *ip_addr, unsigned short port);
    void listenToClients();
    //void listenToCoordinator();
    void shutdown();
 
+   int getCoordinator(const std::string &number);
+
+   void workerThread(Worker &worker);
+   void acceptClients(Worker &worker);
+   void handleClient(int fd, uint32_t events);
+   void sendToCoordinator(int clientId, const std::vector<FactorRequest> &requests);
+   void handleCoordinator(int coord);
+   void coordinatorLost(int coord);
+   bool parseResponse(std::string_view response, int &clientId, int &requestId, std::string &text);
+   void dispatchResponses(std::unordered_map<int, ClientResponses> &responses);
+   bool startMetrics(const char *ip_addr, unsigned short port);
+
 
 private:
-   // Class to manage the server socket for client connections
-   SocketFD _sockfd;
-   // Class to manage the server socket connecting to the coordinator
-   SocketFD _sockfd_coord;
-   int uniqueClientId = 0;
-
-   // List of TCPConn objects to manage connections
-   std::list<std::unique_ptr<TCPConn>> _connClientList;
-   std::unique_ptr<TCPConn> _connCoord;
-   //std::map<int, std::unique_ptr<TCPConn>> clientMap;
+   // Client handling threads, each with its own listening socket
+   std::vector<std::unique_ptr<Worker>> _workers;
+   int numWorkers = 1;
+   std::atomic<bool> _online{true};
+
+   // Sockets connecting to the coordinators. Each number is sent to the coordinator the hash
+   // ring picks for it; a coordinator that goes away is taken off the ring. All workers share
+   // these links, so writes and ring changes happen under _coordMutex
+   std::vector<std::unique_ptr<SocketFD>> _sockfd_coords;
+   std::vector<std::string> _coordNames;
+   std::vector<std::unique_ptr<RingBuffer>> _coordBufs; // received bytes not yet handled
+   // requests sent to each coordinator and not answered yet, by (clientId, requestId), so they
+   // can be sent on to another coordinator if this one goes away
+   std::vector<std::map<std::pair<int, int>, FactorRequest>> _coordPending;
+   HashRing _coordRing;
+   std::mutex _coordMutex;
+   std::atomic<int> uniqueClientId{0};
+
+   // Registry of TCPConn objects to manage connections, by client id (to route coordinator
+   // responses) and by socket (to dispatch epoll events). Shared by the workers and the
+   // coordinator thread, under _clientsMutex
+   std::unordered_map<int, std::shared_ptr<TCPConn>> _clientMap;
+   std::unordered_map<int, std::shared_ptr<TCPConn>> _connClientFDs;
+   std::mutex _clientsMutex;
+
+   // Waits on the coordinators
+   EpollFD _coordEpoll;
+   static const int max_events = 64;
+   static const size_t coord_bufsize = 65536;
+
+   // How often (ms) an idle worker checks whether the server is shutting down
+   static const int worker_poll_ms = 500;
 };
 #endif
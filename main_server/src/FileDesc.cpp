@@ -5,6 +5,10 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
 #include <unistd.h>
 #include <iostream>
 #include <fstream>
@@ -100,19 +104,28 @@ bool FileDesc::hasData(long ms_timeout) {
  *****************************************************************************************/
 
 ssize_t FileDesc::readFD(std::string &buf) {
-   char *readbuf = new char[bufsize];
-   bzero(readbuf, sizeof(char) * bufsize);
+   char readbuf[bufsize];
    ssize_t amt_read = 0;
-   if ((amt_read = read(_fd, readbuf, bufsize)) < 0) {
-      delete readbuf;
+   if ((amt_read = read(_fd, readbuf, bufsize)) < 0)
       return -1;
-   }
    
-   buf = readbuf;
-   delete readbuf;
+   buf.assign(readbuf, amt_read);
    return amt_read;
 }
 
+/*****************************************************************************************
+ * readFD - reads as much data as fits straight into a ring buffer, without copying
+ *
+ *    Params: buf - ring buffer to store the data in; complete lines are taken out with
+ *                  buf.nextLine
+ *
+ *    Returns: returns the amount of data read, 0 at end of file, or -1 for failure
+ *****************************************************************************************/
+
+ssize_t FileDesc::readFD(RingBuffer &buf) {
+   return buf.readFrom(_fd);
+}
+
 /*****************************************************************************************
  * writeFD - writes all the string data provided in str to the FD
  *
@@ -146,10 +159,14 @@ bool FileDesc::isOpen() {
 }
 
 /***************************************************************************************
- * closeFD - closes the FD cleanly
+ * closeFD - closes the FD cleanly. The FD is forgotten so isOpen reports false afterwards
+ *           even if the OS hands the same number to a new socket
  ***************************************************************************************/
 void FileDesc::closeFD() {
+   if (_fd == -1)
+      return;
    close(_fd);
+   _fd = -1;
 }
 
 /****************************************************************************************
@@ -207,6 +224,7 @@ void SocketFD::bindFD(const char *ip_addr, short unsigned int port) {
 
 bool SocketFD::connectTo(const char *ip_addr, unsigned short port) {
 
+   closeFD();
    if ((_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
       throw socket_error("Socket creation failed.");
 
@@ -237,6 +255,93 @@ void SocketFD::listenFD(int backlog) {
 }
 
 
+/*****************************************************************************************
+ * setReusePort - lets several sockets bind the same address and port. The kernel then
+ *                spreads incoming connections across the ones listening. Call before bindFD
+ *
+ *    Throws: socket_error if the option can't be set
+ *****************************************************************************************/
+
+void SocketFD::setReusePort() {
+   int on = 1;
+   if (setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+      throw socket_error("Failed setting SO_REUSEPORT on socket.");
+}
+
+/*****************************************************************************************
+ * queueFD - adds data to the socket's output queue without writing anything. Call flushFD
+ *           to send everything queued
+ *
+ *    Params: data - the bytes to send
+ *****************************************************************************************/
+
+void SocketFD::queueFD(std::string data) {
+   if (data.empty())
+      return;
+   _outBytes += data.size();
+   _outq.push_back(std::move(data));
+}
+
+/*****************************************************************************************
+ * flushFD - writes the output queue to the socket, gathering up to IOV_MAX queued messages
+ *           into each sendmsg call. MSG_MORE is set while more of the queue is left after a
+ *           call, so the kernel can fill whole segments. A partial write leaves the unsent
+ *           bytes queued; on a nonblocking socket that fills up, flushFD stops and should be
+ *           called again once the socket is writable
+ *
+ *    Returns: bytes written, or -1 for a write error other than the socket being full
+ *****************************************************************************************/
+
+ssize_t SocketFD::flushFD() {
+   ssize_t total = 0;
+
+   while (!_outq.empty()) {
+      struct iovec iov[IOV_MAX];
+      int iovcnt = 0;
+      for (auto it = _outq.begin(); it != _outq.end() && iovcnt < IOV_MAX; it++, iovcnt++) {
+         size_t skip = (iovcnt == 0) ? _outOffset : 0;
+         iov[iovcnt].iov_base = const_cast<char *>(it->data()) + skip;
+         iov[iovcnt].iov_len = it->size() - skip;
+      }
+
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iovcnt;
+
+      int flags = MSG_NOSIGNAL;
+      if ((size_t) iovcnt < _outq.size())
+         flags |= MSG_MORE;
+
+      ssize_t sent = sendmsg(_fd, &msg, flags);
+      if (sent == -1) {
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+         return -1;
+      }
+
+      total += sent;
+      _outBytes -= sent;
+
+      // Drop the messages that went out whole and remember how far into the next one we got
+      size_t left = sent;
+      while (left > 0) {
+         size_t remaining = _outq.front().size() - _outOffset;
+         if (left < remaining) {
+            _outOffset += left;
+            break;
+         }
+         left -= remaining;
+         _outq.pop_front();
+         _outOffset = 0;
+      }
+   }
+
+   return total;
+}
+
 /*****************************************************************************************
  * acceptFD - Given a passed-in server FD, accepts a connection and assigns to THIS FD
  *
@@ -248,6 +353,9 @@ void SocketFD::listenFD(int backlog) {
 bool SocketFD::acceptFD(SocketFD &server) {
    socklen_t len = sizeof(_fd_addr);
 
+   // Don't leak the socket the constructor created
+   closeFD();
+
    _fd = accept(server.getFD(), (struct sockaddr *) &_fd_addr, &len);
    if (_fd == -1)
       return false;
@@ -375,3 +483,64 @@ ssize_t FileDesc::readStr(std::string &buf) {
    return buf.size();
 }
 
+
+/******************************************************************************************
+ * EpollFD (constructor) - Creates the epoll instance
+ *
+ *    Throws: socket_error if the epoll instance can't be created
+ ******************************************************************************************/
+
+EpollFD::EpollFD():FileDesc() {
+   _fd = epoll_create1(EPOLL_CLOEXEC);
+   if (_fd == -1)
+      throw socket_error("Epoll creation failed.");
+}
+
+EpollFD::~EpollFD() {
+   closeFD();
+}
+
+/******************************************************************************************
+ * addFD - starts watching fd for the given events (EPOLLIN, EPOLLET, ...). The fd comes back
+ *         in data.fd of the events returned by waitFD
+ *
+ *    Throws: socket_error if the fd can't be added
+ ******************************************************************************************/
+
+void EpollFD::addFD(int fd, uint32_t events) {
+   struct epoll_event ev;
+   ev.events = events;
+   ev.data.fd = fd;
+
+   if (epoll_ctl(_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+      throw socket_error("Failed adding file descriptor to epoll.");
+}
+
+/******************************************************************************************
+ * removeFD - stops watching fd. Must be called before fd is closed
+ ******************************************************************************************/
+
+void EpollFD::removeFD(int fd) {
+   epoll_ctl(_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/******************************************************************************************
+ * waitFD - waits until at least one watched fd is ready
+ *
+ *    Params:  events - filled with the ready fds, up to events.size() of them
+ *             ms_timeout - milliseconds to wait, -1 to wait until something is ready
+ *
+ *    Returns: the number of entries of events filled in (0 on timeout or signal)
+ *
+ *    Throws: socket_error if the wait fails
+ ******************************************************************************************/
+
+int EpollFD::waitFD(std::vector<struct epoll_event> &events, int ms_timeout) {
+   int n = epoll_wait(_fd, events.data(), events.size(), ms_timeout);
+   if (n == -1) {
+      if (errno == EINTR)
+         return 0;
+      throw socket_error("Epoll wait error.");
+   }
+   return n;
+}
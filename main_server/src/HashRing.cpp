@@ -0,0 +1,63 @@
+#include "HashRing.h"
+
+HashRing::HashRing(unsigned int virtualNodes):_virtualNodes(virtualNodes) {
+}
+
+HashRing::~HashRing() {
+}
+
+/**********************************************************************************************
+ * hash - 64-bit FNV-1a, followed by a final mix so that keys differing only in their last
+ *        characters (like consecutive numbers) still land far apart on the ring
+ **********************************************************************************************/
+uint64_t HashRing::hash(const std::string &key) {
+   uint64_t h = 14695981039346656037ULL;
+   for (unsigned char c : key) {
+      h ^= c;
+      h *= 1099511628211ULL;
+   }
+
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   return h;
+}
+
+/**********************************************************************************************
+ * addNode - places a node on the ring at _virtualNodes points
+ *
+ *    Params:  node - value getNode returns for keys owned by this node
+ *             name - unique name of the node, used to pick its points on the ring
+ **********************************************************************************************/
+void HashRing::addNode(int node, const std::string &name) {
+   for (unsigned int i = 0; i < _virtualNodes; i++)
+      _ring[hash(name + "#" + std::to_string(i))] = node;
+}
+
+/**********************************************************************************************
+ * removeNode - takes all of a node's points off the ring; its keys move to the next node
+ *              clockwise
+ **********************************************************************************************/
+void HashRing::removeNode(int node) {
+   for (auto it = _ring.begin(); it != _ring.end(); ) {
+      if (it->second == node)
+         it = _ring.erase(it);
+      else
+         it++;
+   }
+}
+
+/**********************************************************************************************
+ * getNode - finds the node owning key: the first point on the ring at or after key's hash
+ *
+ *    Returns: the node, or -1 if there are no nodes on the ring
+ **********************************************************************************************/
+int HashRing::getNode(const std::string &key) const {
+   if (_ring.empty())
+      return -1;
+
+   auto it = _ring.lower_bound(hash(key));
+   if (it == _ring.end())
+      it = _ring.begin(); // wrap around
+   return it->second;
+}
@@ -0,0 +1,111 @@
+#include <sys/uio.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include "RingBuffer.h"
+
+/******************************************************************************************
+ * RingBuffer (constructor) - Allocates the buffer, rounding capacity up to a power of two
+ ******************************************************************************************/
+
+RingBuffer::RingBuffer(size_t capacity) {
+   _capacity = 1;
+   while (_capacity < capacity)
+      _capacity <<= 1;
+   _mask = _capacity - 1;
+
+   _buf.reset(new char[_capacity]);
+   _frame.reset(new char[_capacity]);
+}
+
+RingBuffer::~RingBuffer() {
+}
+
+/******************************************************************************************
+ * readFrom - reads as much as fits from fd into the free space, with one readv covering both
+ *            pieces when the free space wraps around the end of the buffer
+ *
+ *    Params:  fd - the file descriptor to read from
+ *
+ *    Returns: the amount read, 0 at end of file, or -1 (errno set; ENOBUFS if the buffer is
+ *             full)
+ ******************************************************************************************/
+
+ssize_t RingBuffer::readFrom(int fd) {
+   if (full()) {
+      errno = ENOBUFS;
+      return -1;
+   }
+
+   size_t start = _tail & _mask;
+   size_t free = space();
+
+   struct iovec iov[2];
+   int iovcnt = 1;
+   iov[0].iov_base = _buf.get() + start;
+   iov[0].iov_len = free;
+   if (start + free > _capacity) {
+      iov[0].iov_len = _capacity - start;
+      iov[1].iov_base = _buf.get();
+      iov[1].iov_len = free - iov[0].iov_len;
+      iovcnt = 2;
+   }
+
+   ssize_t amt_read = readv(fd, iov, iovcnt);
+   if (amt_read > 0)
+      _tail += amt_read;
+   return amt_read;
+}
+
+/******************************************************************************************
+ * nextLine - finds the next complete (newline terminated) line, without copying unless it
+ *            wraps around the end of the buffer
+ *
+ *    Params:  line - set to the line, without the newline
+ *
+ *    Returns: true if a line was found (and consumed), false if only a partial one is buffered
+ ******************************************************************************************/
+
+bool RingBuffer::nextLine(std::string_view &line) {
+   // Search what arrived since the last call, in at most two contiguous pieces
+   size_t pos = _head + _scanned;
+   const char *newline = NULL;
+   while (pos < _tail && newline == NULL) {
+      size_t start = pos & _mask;
+      size_t len = std::min(_tail - pos, _capacity - start);
+      newline = (const char *) memchr(_buf.get() + start, '\n', len);
+      if (newline == NULL)
+         pos += len;
+      else
+         pos += newline - (_buf.get() + start);
+   }
+
+   if (newline == NULL) {
+      _scanned = _tail - _head;
+      return false;
+   }
+
+   size_t start = _head & _mask;
+   size_t len = pos - _head;
+   if (start + len <= _capacity) {
+      line = std::string_view(_buf.get() + start, len);
+   } else {
+      size_t first = _capacity - start;
+      memcpy(_frame.get(), _buf.get() + start, first);
+      memcpy(_frame.get() + first, _buf.get(), len - first);
+      line = std::string_view(_frame.get(), len);
+   }
+
+   _head = pos + 1;
+   _scanned = 0;
+   return true;
+}
+
+/******************************************************************************************
+ * clear - drops everything buffered
+ ******************************************************************************************/
+
+void RingBuffer::clear() {
+   _head = _tail = 0;
+   _scanned = 0;
+}
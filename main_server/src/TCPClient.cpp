@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 
 #include "TCPClient.h"
 
@@ -71,14 +73,12 @@ void TCPClient::handleConnection() {
       if (!_sockfd.isOpen())
          break;
 
-      // Send any user input
+      // Send any user input. Requests are pipelined: each is sent as soon as it is typed and
+      // the responses (tagged with their request id) come back as they finish
       if ((sin_bufsize = readStdin()) > 0)  {
          std::string subbuf = _in_buf.substr(0, sin_bufsize+1);
-         if (!blockUserInput) {
-        	 _sockfd.writeFD(subbuf);
-        	 cout << "Input sent to server awaiting response...\n";
-        	 blockUserInput = true; //block until the server responds
-         }
+         _sockfd.writeFD(subbuf);
+         cout << "Input sent to server awaiting response...\n";
          _in_buf.erase(0, sin_bufsize+1);
       }
 
@@ -101,7 +101,6 @@ void TCPClient::handleConnection() {
             std::string str = "\nEnter choice:";
             printf("%s", str.c_str());
             fflush(stdout);
-            blockUserInput = false;
          }
       }
 
@@ -109,6 +108,31 @@ void TCPClient::handleConnection() {
    }
 }
 
+/**********************************************************************************************
+ * uploadFile - Sends a file of numbers (one per line) to the server in upload mode, all in one
+ *              go. The server answers with the range of request ids it gave them, then with each
+ *              number's factors as they finish
+ *
+ *    Throws: runtime_error if the file can't be read
+ **********************************************************************************************/
+
+void TCPClient::uploadFile(const char *filename) {
+   std::ifstream file(filename);
+   if (!file.good())
+      throw std::runtime_error("Could not open upload file.");
+
+   std::stringstream contents;
+   contents << file.rdbuf();
+
+   std::string upload = "upload\n" + contents.str();
+   if (upload.back() != '\n')
+      upload += "\n";
+   upload += "end\n";
+
+   _sockfd.writeFD(upload);
+   cout << "Uploaded " << filename << " awaiting responses...\n";
+}
+
 /**********************************************************************************************
  * closeConnection - Your comments here
  *
@@ -127,18 +151,21 @@ void TCPClient::closeConn() {
  *****************************************************************************/
 int TCPClient::readStdin() {
 
-   if (!_stdin.hasData()) {
-      return 0;
-   }
+   // Lines already buffered (e.g. several pasted at once) are sent before reading more
+   if (_in_buf.find("\n") == std::string::npos) {
+      if (!_stdin.hasData()) {
+         return 0;
+      }
 
-   // More input, get it and concat it to the buffer
-   std::string readbuf;
-   int amt_read;
-   if ((amt_read = _stdin.readFD(readbuf)) < 0) {
-      throw std::runtime_error("Read on stdin failed unexpectedly.");
+      // More input, get it and concat it to the buffer
+      std::string readbuf;
+      int amt_read;
+      if ((amt_read = _stdin.readFD(readbuf)) < 0) {
+         throw std::runtime_error("Read on stdin failed unexpectedly.");
+      }
+      
+      _in_buf += readbuf;
    }
-   
-   _in_buf += readbuf;
 
    // Did we either fill up the buffer or is there a newline/carriage return?
    int sendto;
@@ -4,12 +4,19 @@
 #include <cstring>
 #include <algorithm>
 #include <iostream>
+#include <sstream>
 #include "TCPConn.h"
 #include "strfuncts.h"
+#include "Logger.h"
+#include "Trace.h"
+#include "Metrics.h"
 #include <time.h>
 #include <ctime>
+#include <cerrno>
 
-const std::string logfilename = "server.log";
+static Counter &requestsReceived = Metrics::get().counter("mainserver_requests_received_total", "numbers clients asked to factor");
+static Counter &responsesSent = Metrics::get().counter("mainserver_responses_sent_total", "answers sent to clients");
+static Histogram &requestLatency = Metrics::get().histogram("mainserver_request_latency_us", "time from a client's number arriving to its answer being sent");
 
 TCPConn::TCPConn()
 {
@@ -25,25 +32,9 @@ TCPConn::~TCPConn()
 
 void TCPConn::log(std::string &msg)
 {
-	time_t my_time = time(NULL);
-	msg += " ";
-	msg += ctime(&my_time);
-
-	FileFD logger(logfilename.c_str());
-	if (!logger.openFile(FileFD::appendfd))
-		throw pwfile_error("Could not open log file to write msg");
-
-	std::vector<char> msg_vector = std::vector<char>(msg.begin(), msg.end());
-
-	try
-	{
-		logger.writeBytes(msg_vector);
-	} catch (logfile_error &px)
-	{
-		std::cout << "logger write error";
-		fflush(stdout);
-	}
-	logger.closeFD();
+	// Shared by every connection, so the log file is opened once and lines are written in batches
+	static Logger logger;
+	logger.log(msg);
 }
 
 /**********************************************************************************************
@@ -60,12 +51,13 @@ bool TCPConn::accept(SocketFD &server)
 }
 
 /**********************************************************************************************
- * sendText - simply calls the sendText FileDesc method to send a string to this FD
+ * sendText - queues a string on this FD and flushes the queue, along with anything still waiting
+ *            from earlier
  *
  *    Params:  msg - the string to be sent
  *             size - if we know how much data we should expect to send, this should be populated
  *
- *    Throws: runtime_error for unrecoverable errors
+ *    Returns: 0 for success (the rest goes out once the socket is writable), -1 for write errors
  **********************************************************************************************/
 
 int TCPConn::sendText(const char *msg)
@@ -75,57 +67,120 @@ int TCPConn::sendText(const char *msg)
 
 int TCPConn::sendText(const char *msg, int size)
 {
-	if (_connfd.writeFD(msg, size) < 0)
+	queueText(std::string(msg, size));
+	return flush();
+}
+
+/**********************************************************************************************
+ * queueText - adds a string to this FD's output queue without writing it. Replies made while
+ *             handling a read are queued and go out in one flush at the end
+ *
+ *    Params:  msg - the string to be sent
+ **********************************************************************************************/
+
+void TCPConn::queueText(std::string msg)
+{
+	std::lock_guard<std::mutex> lock(_sendMutex);
+	_connfd.queueFD(std::move(msg));
+}
+
+/**********************************************************************************************
+ * flush - writes as much of the output queue as the socket takes. Whatever is left is written
+ *         when epoll reports the socket writable again. A client that lets too much pile up
+ *         without reading is shut down; its worker sees the hangup and drops it
+ *
+ *    Returns: 0 for success, -1 for write errors
+ **********************************************************************************************/
+
+int TCPConn::flush()
+{
+	std::lock_guard<std::mutex> lock(_sendMutex);
+	if (!_connfd.isOpen())
+		return -1;
+
+	if (_connfd.flushFD() < 0 || _connfd.pendingBytes() > client_max_pending)
 	{
+		::shutdown(_connfd.getFD(), SHUT_RDWR);
 		return -1;
 	}
 	return 0;
 }
 
 /**********************************************************************************************
- * handleConnection - performs a check of the connection, looking for data on the socket and
- *                    handling it based on the _status, or stage, of the connection
+ * handleConnection - reads everything waiting on the socket and handles each complete command
+ *                    based on the _status, or stage, of the connection. The socket is read until
+ *                    it would block, so this only needs calling when it becomes readable. Each
+ *                    read fills the input ring buffer and the commands in it are handled before
+ *                    reading again, so input of any length goes through a fixed size buffer
+ *
+ *    Returns: the numbers to be factored, in the order they were entered, with their request ids
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 
-std::string TCPConn::handleConnection()
+std::vector<FactorRequest> TCPConn::handleConnection()
 {
-
-	timespec sleeptime;
-	sleeptime.tv_sec = 0;
-	sleeptime.tv_nsec = 100000000;
-
-	std::string cmd = "";
+	std::vector<FactorRequest> cmds;
+	std::string cmd;
 
 	try
 	{
-		switch (_status)
+		while (isConnected())
 		{
-
-			case s_menu:
-				cmd = getMenuChoice();
-				break;
-
-			default:
-				throw std::runtime_error("Invalid connection status!");
+			ssize_t amt_read = _connfd.readFD(_inputbuf);
+			if (amt_read == -1 && errno == EINTR)
+				continue;
+			bool drained = (amt_read == -1) && (errno == EAGAIN || errno == EWOULDBLOCK);
+			bool closed = (amt_read == 0) || (amt_read == -1 && !drained);
+
+			while (isConnected() && getUserInput(cmd))
+			{
+				switch (_status)
+				{
+
+					case s_menu:
+						getMenuChoice(cmd, cmds);
+						break;
+
+					case s_upload:
+						getUploadLine(cmd, cmds);
+						break;
+
+					default:
+						throw std::runtime_error("Invalid connection status!");
+						break;
+				}
+			}
+
+			// A line that doesn't fit in the buffer can't be a command; skip to its end
+			if (_inputbuf.full())
+			{
+				_inputbuf.clear();
+				_discardLine = true;
+				queueText("Input line too long, discarded\n");
+			}
+
+			if (closed)
+				disconnect();
+			if (closed || drained)
 				break;
 		}
+
+		// Everything the commands replied goes out together
+		if (isConnected())
+			flush();
 	} catch (socket_error &e)
 	{
 		std::cout << "Socket error, disconnecting.";
 		disconnect();
-		return "";
 	}
 
-	nanosleep(&sleeptime, NULL);
-	return cmd;
+	return cmds;
 }
 
 /**********************************************************************************************
- * getUserInput - Gets user data and includes a buffer to look for a carriage return before it is
- *                considered a complete user input. Performs some post-processing on it, removing
- *                the newlines
+ * getUserInput - Takes the next complete (newline terminated) user input out of the input
+ *                buffer. Performs some post-processing on it, removing the newlines
  *
  *    Params: cmd - the buffer to store commands - contents left alone if no command found
  *
@@ -136,21 +191,19 @@ std::string TCPConn::handleConnection()
 
 bool TCPConn::getUserInput(std::string &cmd)
 {
-	std::string readbuf;
-
-	// read the data on the socket
-	_connfd.readFD(readbuf);
-
-	// concat the data onto anything we've read before
-	_inputbuf += readbuf;
-
 	// If it doesn't have a carriage return, then it's not a command
-	int crpos;
-	if ((crpos = _inputbuf.find("\n")) == std::string::npos)
+	std::string_view line;
+	if (!_inputbuf.nextLine(line))
 		return false;
 
-	cmd = _inputbuf.substr(0, crpos);
-	_inputbuf.erase(0, crpos + 1);
+	// The rest of a line that was too long
+	if (_discardLine)
+	{
+		_discardLine = false;
+		return getUserInput(cmd);
+	}
+
+	cmd.assign(line.data(), line.size());
 
 	// Remove \r if it is there
 	clrNewlines(cmd);
@@ -159,51 +212,202 @@ bool TCPConn::getUserInput(std::string &cmd)
 }
 
 /**********************************************************************************************
- * getMenuChoice - Gets the user's command and interprets it, calling the appropriate function
- *                 if required.
+ * getMenuChoice - Interprets the user's command, calling the appropriate function if required.
+ *
+ *    Params:  cmd - the command
+ *             requests - numbers to be factored are added here
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 
-std::string TCPConn::getMenuChoice()
+void TCPConn::getMenuChoice(std::string cmd, std::vector<FactorRequest> &requests)
 {
-	if (!_connfd.hasData())
-		return "";
-	std::string cmd;
-	if (!getUserInput(cmd))
-		return "";
 	lower(cmd);
 
 	std::string ip;
 	getIPAddrStr(ip);
 
-	std::string msg;
-
 	if (cmd.compare("exit") == 0)
 	{
 		std::string msg = "Session disconnect from IP: " + ip + " - session terminated\n";
 		log(msg);
-		_connfd.writeFD("Disconnecting...goodbye!\n");
+		queueText("Disconnecting...goodbye!\n");
+		flush();
 		disconnect();
 	}
 	else if (cmd.compare("menu") == 0)
 	{
 		sendMenu();
 	}
+	else if (cmd.compare(0, 6, "batch ") == 0)
+	{
+		getBatch(cmd.substr(6), requests);
+	}
+	else if (cmd.compare(0, 7, "budget ") == 0)
+	{
+		setBudget(cmd.substr(7));
+	}
+	else if (cmd.compare("upload") == 0)
+	{
+		_status = s_upload;
+		_uploadCount = 0;
+		_uploadFirstId = _nextRequestId;
+		_uploadRejected = 0;
+		queueText("Upload mode: send one number per line, then 'end'\n");
+	}
 	else
 	{
 		if (isNum(cmd))
-			msg = cmd;
+			requests.push_back(newRequest(cmd));
 		else
 		{
-			msg = "Unrecognized command: ";
+			std::string msg = "Unrecognized command: ";
 			msg += cmd;
 			msg += "\n";
-			_connfd.writeFD(msg);
-			msg = "";
+			queueText(msg);
 		}
 	}
-	return msg;
+}
+
+/**********************************************************************************************
+ * getBatch - Takes every number in a "batch" command (separated by spaces or commas) as its own
+ *            request and tells the client which request ids they got
+ *
+ *    Params:  numbers - the command after "batch "
+ *             requests - the numbers are added here
+ **********************************************************************************************/
+
+void TCPConn::getBatch(std::string numbers, std::vector<FactorRequest> &requests)
+{
+	std::replace(numbers.begin(), numbers.end(), ',', ' ');
+	std::istringstream tokens(numbers);
+
+	int firstId = _nextRequestId, count = 0;
+	std::string number, rejected;
+	while (tokens >> number) {
+		if (isNum(number)) {
+			requests.push_back(newRequest(number));
+			count++;
+		} else
+			rejected += " " + number;
+	}
+
+	std::string msg = "Batch of " + std::to_string(count) + " number(s)";
+	if (count > 0)
+		msg += " queued as requests " + std::to_string(firstId) + "-" + std::to_string(_nextRequestId - 1);
+	if (rejected.length() > 0)
+		msg += ", rejected:" + rejected;
+	msg += "\n";
+	queueText(msg);
+}
+
+/**********************************************************************************************
+ * setBudget - Handles the "budget" command: the time in milliseconds, and optionally the number
+ *             of iterations, the client's requests may take before they are answered with the
+ *             primes found so far and the part left unfactored. 0 removes the limit
+ *
+ *    Params:  args - the command after "budget "
+ **********************************************************************************************/
+
+void TCPConn::setBudget(std::string args)
+{
+	std::istringstream tokens(args);
+	std::string ms, iterations, extra;
+	tokens >> ms >> iterations >> extra;
+
+	if (!isNum(ms) || (!iterations.empty() && !isNum(iterations)) || !extra.empty() || ms.length() > 9 || iterations.length() > 18) {
+		queueText("Usage: budget <milliseconds> [<iterations>], 0 for no limit\n");
+		return;
+	}
+
+	_budgetMs = std::stoul(ms);
+	_budgetIterations = iterations.empty() ? 0 : std::stoul(iterations);
+
+	std::string msg = "Budget for new requests: ";
+	msg += _budgetMs == 0 ? "no time limit" : std::to_string(_budgetMs) + " ms";
+	msg += _budgetIterations == 0 ? ", no iteration limit" : ", " + std::to_string(_budgetIterations) + " iterations";
+	msg += "\n";
+	queueText(msg);
+}
+
+/**********************************************************************************************
+ * getUploadLine - Handles a line received in upload mode: each number becomes a request, "end"
+ *                 goes back to the menu and reports the request ids the upload got. Nothing is
+ *                 sent back per line
+ *
+ *    Params:  cmd - the line
+ *             requests - the number is added here
+ **********************************************************************************************/
+
+void TCPConn::getUploadLine(std::string cmd, std::vector<FactorRequest> &requests)
+{
+	lower(cmd);
+
+	if (isNum(cmd)) {
+		requests.push_back(newRequest(cmd));
+		_uploadCount++;
+	} else if (cmd.compare("end") == 0) {
+		_status = s_menu;
+		std::string msg = "Upload of " + std::to_string(_uploadCount) + " number(s)";
+		if (_uploadCount > 0)
+			msg += " queued as requests " + std::to_string(_uploadFirstId) + "-" + std::to_string(_nextRequestId - 1);
+		if (_uploadRejected > 0)
+			msg += ", " + std::to_string(_uploadRejected) + " line(s) rejected";
+		msg += "\n";
+		queueText(msg);
+	} else if (cmd.length() > 0) {
+		_uploadRejected++;
+	}
+}
+
+/**********************************************************************************************
+ * newRequest - Tags a number with the connection's next request id
+ **********************************************************************************************/
+
+FactorRequest TCPConn::newRequest(const std::string &number)
+{
+	FactorRequest request;
+	request.requestId = _nextRequestId++;
+	request.number = number;
+	request.budgetMs = _budgetMs;
+	request.budgetIterations = _budgetIterations;
+	Trace::get().record(tr_request_received, id, request.requestId);
+	requestsReceived.add();
+	{
+		std::lock_guard<std::mutex> lock(_requestTimesMutex);
+		_requestTimes[request.requestId] = std::chrono::steady_clock::now();
+	}
+	return request;
+}
+
+/**********************************************************************************************
+ * requestsAnswered - Records that answers to these requests were just sent to the client
+ **********************************************************************************************/
+
+void TCPConn::requestsAnswered(const std::vector<int> &requestIds)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(_requestTimesMutex);
+	for (int requestId : requestIds) {
+		Trace::get().record(tr_response_sent, id, requestId);
+		responsesSent.add();
+
+		auto requestTime = _requestTimes.find(requestId);
+		if (requestTime == _requestTimes.end())
+			continue;
+		requestLatency.record(std::chrono::duration_cast<std::chrono::microseconds>(now - requestTime->second).count());
+		_requestTimes.erase(requestTime);
+	}
+}
+
+/**********************************************************************************************
+ * pendingRequests - How many of this client's requests haven't been answered yet
+ **********************************************************************************************/
+
+size_t TCPConn::pendingRequests()
+{
+	std::lock_guard<std::mutex> lock(_requestTimesMutex);
+	return _requestTimes.size();
 }
 
 bool TCPConn::isNum(const std::string& s)
@@ -213,7 +417,7 @@ bool TCPConn::isNum(const std::string& s)
 }
 
 /**********************************************************************************************
- * sendMenu - sends the menu to the user via their socket
+ * sendMenu - queues the menu for the user's socket; it goes out with the next flush
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
@@ -227,10 +431,14 @@ void TCPConn::sendMenu()
 	//menustr += "  4). 20 digits: 39483928374837104097, returns: 3*3*3*19*27967*29129*94478183\n";
 	//menustr += "  5). 25 digits: 3829387463527123647384769, returns: 29*41*15413*2798639*74664368503\n";
 	menustr += "  Enter a number to be factored: \n";
+	menustr += "  Batch <n1> <n2> ... - factor several numbers at once\n";
+	menustr += "  Upload - send numbers one per line until 'end'\n";
+	menustr += "  Budget <ms> [<iterations>] - answer later requests with what is found in that long (0 for no limit)\n";
 	menustr += "  Menu - display this menu\n";
 	menustr += "  Exit - disconnect.\n";
+	menustr += "Requests are numbered from 1 in the order sent; each response carries its request id.\n";
 
-	_connfd.writeFD(menustr);
+	queueText(menustr);
 }
 
 /**********************************************************************************************
@@ -240,6 +448,7 @@ void TCPConn::sendMenu()
  **********************************************************************************************/
 void TCPConn::disconnect()
 {
+	std::lock_guard<std::mutex> lock(_sendMutex);
 	_connfd.closeFD();
 	_connfdcoord.closeFD();
 }
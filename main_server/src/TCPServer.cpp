@@ -10,6 +10,8 @@
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <cerrno>
+#include <charconv>
 #include "TCPServer.h"
 #include "strfuncts.h"
 
@@ -20,29 +22,62 @@ TCPServer::TCPServer() {}
 TCPServer::~TCPServer() {}
 
 /**********************************************************************************************
- * bindSvr - Creates a network socket and sets it nonblocking so we can loop through looking for
- *           data. Then binds it to the ip address and port
+ * bindSvr - Creates a network socket for each worker and sets it nonblocking so we can loop
+ *           through looking for data. Then binds it to the ip address and port. With more than
+ *           one worker the sockets share the port through SO_REUSEPORT
  *
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
 void TCPServer::bindSvr(const char *ip_addr, short unsigned int port)
 {
+	for (int i = 0; i < numWorkers; i++) {
+		std::unique_ptr<Worker> worker(new Worker());
 
-	struct sockaddr_in servaddr;
+		// Set the socket to nonblocking
+		worker->listenfd.setNonBlocking();
+		if (numWorkers > 1)
+			worker->listenfd.setReusePort();
 
-	// Set the socket to nonblocking
-	_sockfd.setNonBlocking();
-
-	// Load the socket information to prep for binding
-	_sockfd.bindFD(ip_addr, port);
+		// Load the socket information to prep for binding
+		worker->listenfd.bindFD(ip_addr, port);
 
+		_workers.push_back(std::move(worker));
+	}
 }
 
+/**********************************************************************************************
+ * connectToCoordinator - Connects to a coordinator and adds it to the hash ring. Can be called
+ *                        once per coordinator to shard the numbers across several of them
+ *
+ *    Throws: socket_error if the connection fails
+ **********************************************************************************************/
+
 void TCPServer::connectToCoordinator(const char *ip_addr, unsigned short port)
 {
-   if (!_sockfd_coord.connectTo(ip_addr, port))
+   std::unique_ptr<SocketFD> coord(new SocketFD());
+   if (!coord->connectTo(ip_addr, port))
 	  throw socket_error("TCP Connection to Coordinator failed!");
+
+   std::string name = std::string(ip_addr) + ":" + std::to_string(port);
+   std::lock_guard<std::mutex> lock(_coordMutex);
+   _coordRing.addNode(_sockfd_coords.size(), name);
+   _sockfd_coords.push_back(std::move(coord));
+   _coordNames.push_back(name);
+   _coordBufs.push_back(std::unique_ptr<RingBuffer>(new RingBuffer(coord_bufsize)));
+   _coordPending.emplace_back();
+}
+
+/**********************************************************************************************
+ * getCoordinator - Picks the coordinator responsible for a number by consistent hashing, so the
+ *                  same number always goes to the same coordinator while it is up
+ *
+ *    Returns: index into _sockfd_coords, or -1 if no coordinators are left
+ **********************************************************************************************/
+
+int TCPServer::getCoordinator(const std::string &number)
+{
+	return _coordRing.getNode(number);
 }
 /*
 void TCPServer::listenToCoordinator()
@@ -63,159 +98,421 @@ void TCPServer::listenToCoordinator()
 }
 */
 /**********************************************************************************************
- * listenSvr - Performs a loop to look for connections and create TCPConn objects to handle
- *             them. Also loops through the list of connections and handles data received and
- *             sending of data. 
+ * listenToClients - Starts the worker threads, which accept and handle the clients, then runs
+ *                   the coordinator event loop on this thread: waits on epoll for responses
+ *                   from the coordinators and routes each one to its client. Returns once every
+ *                   coordinator is gone and the workers have stopped.
  *
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
 void TCPServer::listenToClients()
 {
+	std::vector<struct epoll_event> events(max_events);
 
-	bool online = true;
-	timespec sleeptime;
-	sleeptime.tv_sec = 0;
-	sleeptime.tv_nsec = 100000000;
-	int num_read = 0;
+	TCPConn logconn;
+	std::string msg = "TCPServer is online with " + std::to_string(_workers.size()) + " worker(s)";
+	logconn.log(msg);
 
-	// Start the server socket listening
-	_sockfd.listenFD(5);
+	for (unsigned int coord = 0; coord < _sockfd_coords.size(); coord++)
+		_coordEpoll.addFD(_sockfd_coords[coord]->getFD(), EPOLLIN);
 
-	TCPConn *new_conn = new TCPConn();
-	std::string msg = "TCPServer is online";
-	new_conn->log(msg);
+	for (auto &worker : _workers)
+		worker->thread = std::thread(&TCPServer::workerThread, this, std::ref(*worker));
 
-	while (online)
+	while (_online)
 	{
-		struct sockaddr_in cliaddr;
-		socklen_t len = sizeof(cliaddr);
+		int n = _coordEpoll.waitFD(events, worker_poll_ms);
+
+		for (int i = 0; i < n; i++)
+			for (unsigned int coord = 0; coord < _sockfd_coords.size(); coord++)
+				if (_sockfd_coords[coord]->getFD() == events[i].data.fd)
+					handleCoordinator(coord);
+
+		std::lock_guard<std::mutex> lock(_coordMutex);
+		if (_coordRing.empty()) {
+			// If every coordinator is gone, exit
+			cout << "All coordinator sockets are closed! So, shutting down...\n";
+			_online = false;
+		}
+	}
 
-		if (_sockfd.hasData())
+	for (auto &worker : _workers)
+		worker->thread.join();
+
+	shutdown();
+}
+
+/**********************************************************************************************
+ * workerThread - Runs a worker's event loop: waits on epoll for its listening socket and its
+ *                clients, and only handles the ones that have something to read. Client sockets
+ *                are edge-triggered, so each one is drained when it becomes readable. Nothing
+ *                sleeps; the loop blocks in epoll_wait when idle.
+ *
+ *    Params:  worker - the worker whose socket and clients this thread handles
+ **********************************************************************************************/
+
+void TCPServer::workerThread(Worker &worker)
+{
+	std::vector<struct epoll_event> events(max_events);
+
+	try {
+		// Start the server socket listening
+		worker.listenfd.listenFD(128);
+		worker.epoll.addFD(worker.listenfd.getFD(), EPOLLIN | EPOLLET);
+
+		while (_online)
 		{
-			new_conn = new TCPConn();
-			if (!new_conn->accept(_sockfd))
+			int n = worker.epoll.waitFD(events, worker_poll_ms);
+
+			for (int i = 0; i < n; i++)
 			{
-				std::string msg = "Data received on socket but failed to accept.";
-				new_conn->log(msg);
-				continue;
+				if (events[i].data.fd == worker.listenfd.getFD())
+					acceptClients(worker);
+				else
+					handleClient(events[i].data.fd, events[i].events);
 			}
-			std::cout << "***Got a connection***\n";
-			fflush(stdout);
+		}
+	} catch (std::runtime_error &e) {
+		cerr << "Worker stopped on error: " << e.what() << endl;
+		_online = false;
+	}
+}
 
-			//set the id on this connection
-			new_conn->id = std::to_string(uniqueClientId++);
-			_connClientList.push_back(std::unique_ptr<TCPConn>(new_conn));
+/**********************************************************************************************
+ * acceptClients - Accepts every pending connection on a worker's listening socket, creating a
+ *                 nonblocking TCPConn for each, registering it and adding it to the worker's
+ *                 epoll set
+ *
+ *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ **********************************************************************************************/
 
-			// Get their IP Address string to use in logging
-			std::string ipaddr_str;
-			new_conn->getIPAddrStr(ipaddr_str);
+void TCPServer::acceptClients(Worker &worker)
+{
+	while (true)
+	{
+		std::shared_ptr<TCPConn> new_conn(new TCPConn());
+		if (!new_conn->accept(worker.listenfd))
+		{
+			// Nothing left to accept
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
 
-			new_conn->sendText("Welcome to the Prime Number Factorization App!\n");
-			new_conn->sendMenu();
+			std::string msg = "Data received on socket but failed to accept.";
+			new_conn->log(msg);
+			break;
 		}
+		std::cout << "***Got a connection***\n";
+		fflush(stdout);
+
+		//set the id on this connection
+		new_conn->id = uniqueClientId++;
+		new_conn->setNonBlocking();
+
+		// Get their IP Address string to use in logging
+		std::string ipaddr_str;
+		new_conn->getIPAddrStr(ipaddr_str);
 
-		// Loop through our client connections, handling them
-		std::list<std::unique_ptr<TCPConn>>::iterator tptr = _connClientList.begin();
-		while (tptr != _connClientList.end())
+		new_conn->queueText("Welcome to the Prime Number Factorization App!\n");
+		new_conn->sendMenu();
+		new_conn->flush();
+
+		int fd = new_conn->getFD();
 		{
-			// If the user lost connection
-			if (!(*tptr)->isConnected())
-			{
-				// Log it
+			std::lock_guard<std::mutex> lock(_clientsMutex);
+			_clientMap[new_conn->id] = new_conn;
+			_connClientFDs[fd] = new_conn;
+		}
+		worker.epoll.addFD(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+	}
+}
+
+/**********************************************************************************************
+ * handleClient - Handles a client socket that became ready. When writable, output that didn't
+ *                fit earlier is flushed; when readable, each number it sent is forwarded to the
+ *                coordinator that owns it. Drops the client if it disconnected
+ *
+ *    Params:  fd - the client's socket
+ *             events - what epoll reported for it
+ *
+ *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ **********************************************************************************************/
+
+void TCPServer::handleClient(int fd, uint32_t events)
+{
+	std::shared_ptr<TCPConn> conn;
+	{
+		std::lock_guard<std::mutex> lock(_clientsMutex);
+		auto tptr = _connClientFDs.find(fd);
+		if (tptr == _connClientFDs.end())
+			return;
+		conn = tptr->second;
+	}
+
+	if (events & EPOLLOUT)
+		conn->flush();
+
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		std::vector<FactorRequest> requests = conn->handleConnection();
+		if (requests.size() > 0) {
+			cout << "id = " << conn->id << "\n";
+			sendToCoordinator(conn->id, requests);
+		}
+	}
+
+	// If the user lost connection, remove them from the connect list (closing the socket
+	// already took it out of the epoll set). Once closed, the fd number may already have been
+	// reused by a client another worker accepted, so only our own entry is removed
+	if (!conn->isConnected())
+	{
+		std::lock_guard<std::mutex> lock(_clientsMutex);
+		_clientMap.erase(conn->id);
+		auto tptr = _connClientFDs.find(fd);
+		if (tptr != _connClientFDs.end() && tptr->second == conn)
+			_connClientFDs.erase(tptr);
+		std::cout << "Connection disconnected.\n";
+		fflush(stdout);
+	}
+}
+
+/**********************************************************************************************
+ * sendToCoordinator - Sends a client's numbers to the coordinators that own them on the hash
+ *                     ring, as one write per coordinator. Each one is remembered as pending on
+ *                     its coordinator until it is answered. With no coordinators left, the
+ *                     client is told its requests failed
+ *
+ *    Params:  clientId - id of the client that asked
+ *             requests - the numbers to be factored, with their request ids
+ **********************************************************************************************/
 
-				// Remove them from the connect list
-				tptr = _connClientList.erase(tptr);
-				std::cout << "Connection disconnected.\n";
-				fflush(stdout);
+void TCPServer::sendToCoordinator(int clientId, const std::vector<FactorRequest> &requests)
+{
+	std::unordered_map<int, ClientResponses> unsent;
+	{
+		std::lock_guard<std::mutex> lock(_coordMutex);
+
+		std::map<int, std::string> batches;
+		for (const FactorRequest &request : requests) {
+			int coord = getCoordinator(request.number);
+			if (coord == -1) {
+				ClientResponses &client = unsent[clientId];
+				client.text += "Error handling factors [" + std::to_string(request.requestId) + "] " + request.number + ": no coordinator available\n";
+				client.requestIds.push_back(request.requestId);
 				continue;
 			}
+			_coordPending[coord][std::make_pair(clientId, request.requestId)] = request;
 
-			std::string cmd = (*tptr)->handleConnection();
-			if (cmd.length()> 1) {
-				std::string clientId = (*tptr)->id;
-				cout << "id = " << clientId << "\n";
-				std::string coordRequest = "FACTOR_REQ|" + clientId + "|" + cmd;
-				cout << "sending " << coordRequest << "\n";
-				_sockfd_coord.writeFD(coordRequest.c_str());
-			}
-			// Increment our iterator
-			tptr++;
+			// the coordinator splits requests on newlines
+			batches[coord] += "FACTOR_REQ|" + std::to_string(clientId) + "|" + std::to_string(request.requestId) + "|" + request.number;
+			if (request.budgetMs != 0 || request.budgetIterations != 0)
+				batches[coord] += "|" + std::to_string(request.budgetMs) + "|" + std::to_string(request.budgetIterations);
+			batches[coord] += "\n";
 		}
 
+		for (auto &batch : batches) {
+			cout << "sending " << batch.second.substr(0, batch.second.length() - 1) << " to coordinator " << _coordNames[batch.first] << "\n";
+			_sockfd_coords[batch.first]->queueFD(std::move(batch.second));
+			_sockfd_coords[batch.first]->flushFD();
+		}
+	}
 
-		//now handle incoming coordinator messages
-		int sin_bufsize = 0;
-		ssize_t rsize = 0;
+	dispatchResponses(unsent);
+}
 
-		// If the connection was closed, exit
-		if (!_sockfd_coord.isOpen()) {
-			cout << "Coordinator socket is closed! So, shutting down...\n";
-			shutdown();
-			break;
+/**********************************************************************************************
+ * handleCoordinator - Reads whatever a coordinator sent and appends it to that link's receive
+ *                     buffer. Every complete (newline terminated) response in the buffer is
+ *                     parsed and the results are sent to their clients in one batch; a partial
+ *                     response stays buffered until the rest arrives. A coordinator that
+ *                     disconnected is taken off the ring so its numbers, and the requests it
+ *                     hadn't answered, move to the next one
+ *
+ *    Params:  coord - index of the coordinator in _sockfd_coords
+ *
+ *    Throws: runtime_error if the read fails
+ **********************************************************************************************/
+
+void TCPServer::handleCoordinator(int coord)
+{
+	SocketFD &sockfd_coord = *_sockfd_coords[coord];
+	RingBuffer &buf = *_coordBufs[coord];
+	ssize_t rsize = 0;
+
+	if ((rsize = sockfd_coord.readFD(buf)) == -1) {
+		if (errno == EINTR)
+			return;
+		throw std::runtime_error("Read on coordinator socket failed.");
+	}
+
+	// Readable but 0 bytes...usually because it's disconnected
+	if (rsize == 0) {
+		coordinatorLost(coord);
+		return;
+	}
+
+	// Pull out every complete response, collecting the text and request ids for each client
+	std::unordered_map<int, ClientResponses> responses;
+	std::string_view line;
+	while (buf.nextLine(line)) {
+		int clientId, requestId;
+		std::string text;
+		if (parseResponse(line, clientId, requestId, text)) {
+			ClientResponses &client = responses[clientId];
+			client.text += text;
+			client.requestIds.push_back(requestId);
 		}
+	}
 
-		// Read any response from coord, connect it to a client via the map, then send the response to that client
-		std::string buf;
-		if (_sockfd_coord.hasData()) {
-			if ((rsize = _sockfd_coord.readFD(buf)) == -1) {
-				throw std::runtime_error("Read on coordinator socket failed.");
-			}
+	{
+		std::lock_guard<std::mutex> lock(_coordMutex);
+		for (auto &response : responses)
+			for (int requestId : response.second.requestIds)
+				_coordPending[coord].erase(std::make_pair(response.first, requestId));
+	}
 
-			// Select indicates data, but 0 bytes...usually because it's disconnected
-			if (rsize == 0) {
-				shutdown();
-				break;
-			}
+	// A response that doesn't fit in the buffer can't be parsed
+	if (buf.full()) {
+		cout << "Response from coordinator " << _coordNames[coord] << " too long, discarding it\n";
+		buf.clear();
+	}
 
-			if (rsize > 0) {
-				cout << "There is a response from coord...\n";
-				std::string response = buf.c_str();
-				std::string left, right;
-				std::string err = "Error handling factors: Main Server";
-				bool bValid = split(response, left, right, '|');
-				if (bValid) {
-					bValid = split(right, left, right, '|'); //now we have clientId in the left
-					if (bValid) {
-						// Loop through our client connections to find out which one to send the msg to
-						std::list<std::unique_ptr<TCPConn>>::iterator tptr = _connClientList.begin();
-						while (tptr != _connClientList.end()) {
-							std::string clientId = left;
-							cout << "clientId = " << clientId << "\n";
-							if ((*tptr)->id == clientId) {
-								//if lost connection
-								if (!(*tptr)->isConnected())
-									std::cout << "This client has disconnected.\n";
-								//isolate the factors to send back to the client
-								bValid = split(response, left, response, '|');//clean off command
-								if (bValid)
-									bValid = split(response, left, response, '|');//clean off id
-								if (bValid)
-									bValid = split(response, left, response, '|');//clean off the original number
-								if (bValid) {
-									response = "Prime Factors: " + response;
-									//send it to client
-									(*tptr)->sendText(response.c_str());
-									buf.erase(0, response.length());
-								} else {
-									(*tptr)->sendText(err.c_str());
-									buf.erase(0, err.length());
-								}
-								break;
-							}
-							// Increment our iterator
-							tptr++;
-						}
-					}
-				}
-			}
+	dispatchResponses(responses);
+}
+
+/**********************************************************************************************
+ * coordinatorLost - Takes a coordinator that disconnected off the ring and sends the requests
+ *                   it hadn't answered to the coordinators that own their numbers now
+ *
+ *    Params:  coord - index of the coordinator in _sockfd_coords
+ **********************************************************************************************/
+
+void TCPServer::coordinatorLost(int coord)
+{
+	std::map<std::pair<int, int>, FactorRequest> pending;
+	{
+		std::lock_guard<std::mutex> lock(_coordMutex);
+		cout << "Coordinator " << _coordNames[coord] << " disconnected, removing it from the ring\n";
+		_coordEpoll.removeFD(_sockfd_coords[coord]->getFD());
+		_sockfd_coords[coord]->closeFD();
+		_coordRing.removeNode(coord);
+		std::swap(pending, _coordPending[coord]);
+	}
+
+	std::map<int, std::vector<FactorRequest>> requests; // by client id
+	for (auto &request : pending)
+		requests[request.first.first].push_back(request.second);
+
+	for (auto &client : requests) {
+		cout << "Resending " << client.second.size() << " request(s) of client " << client.first << " that coordinator " << _coordNames[coord] << " didn't answer\n";
+		sendToCoordinator(client.first, client.second);
+	}
+}
+
+/**********************************************************************************************
+ * parseResponse - Turns one coordinator response (FACTOR_RESP|clientId|requestId|number|primes
+ *                 [|unfactored]) into the text for the client, tagged with the request id. A
+ *                 response with unfactored cofactors ran out of budget and is shown as partial.
+ *                 A number the coordinator couldn't factor at all comes back as
+ *                 FACTOR_ERR|clientId|requestId|number|error
+ *
+ *    Params:  response - the response, without its newline
+ *             clientId - set to the client the response is for
+ *             requestId - set to the request it answers, or -1 if it has none
+ *             text - set to the line to send the client
+ *
+ *    Returns: false if the response isn't for any client, true otherwise
+ **********************************************************************************************/
+
+bool TCPServer::parseResponse(std::string_view response, int &clientId, int &requestId, std::string &text)
+{
+	// FACTOR_RESP|clientId|requestId|number|primes[|unfactored], taken apart without copying
+	std::string_view fields[6];
+	unsigned int nfields = 0;
+	while (nfields < 5) {
+		auto pos = response.find('|');
+		if (pos == std::string_view::npos)
+			break;
+		fields[nfields++] = response.substr(0, pos);
+		response.remove_prefix(pos + 1);
+	}
+	fields[nfields++] = response;
+
+	if (nfields < 2) {
+		cout << "Unrecognized response from coordinator: " << response << "\n";
+		return false;
+	}
+	clientId = -1;
+	std::from_chars(fields[1].data(), fields[1].data() + fields[1].size(), clientId);
+	requestId = -1;
+	if (nfields > 2)
+		std::from_chars(fields[2].data(), fields[2].data() + fields[2].size(), requestId);
+
+	//isolate the factors to send back to the client
+	if (nfields == 5 && fields[0] == "FACTOR_RESP") {
+		text = "Prime Factors [";
+		text.append(fields[2]).append("] ").append(fields[3]).append(": ").append(fields[4]).append("\n");
+	} else if (nfields == 6 && fields[0] == "FACTOR_RESP") {
+		text = "Partial Factors [";
+		text.append(fields[2]).append("] ").append(fields[3]).append(": ").append(fields[4]).append(" unfactored: ").append(fields[5]).append("\n");
+	} else if (nfields == 5 && fields[0] == "FACTOR_ERR") {
+		text = "Error handling factors [";
+		text.append(fields[2]).append("] ").append(fields[3]).append(": ").append(fields[4]).append("\n");
+	} else
+		text = "Error handling factors: Main Server\n";
+	return true;
+}
+
+/**********************************************************************************************
+ * dispatchResponses - Sends each client the responses collected for it. The clients are all
+ *                     looked up under one hold of the registry lock, then written to outside it
+ *
+ *    Params:  responses - text to send and the requests it answers, by client id
+ **********************************************************************************************/
+
+void TCPServer::dispatchResponses(std::unordered_map<int, ClientResponses> &responses)
+{
+	std::vector<std::pair<std::shared_ptr<TCPConn>, ClientResponses *>> sends;
+	sends.reserve(responses.size());
+	{
+		std::lock_guard<std::mutex> lock(_clientsMutex);
+		for (auto &response : responses) {
+			auto tptr = _clientMap.find(response.first);
+			if (tptr != _clientMap.end())
+				sends.push_back(std::make_pair(tptr->second, &response.second));
+			else
+				std::cout << "Client " << response.first << " has disconnected.\n";
 		}
+	}
 
-		// So we're not chewing up CPU cycles unnecessarily
-		nanosleep(&sleeptime, NULL);
+	for (auto &send : sends) {
+		send.first->sendText(send.second->text.c_str(), send.second->text.length());
+		send.first->requestsAnswered(send.second->requestIds);
 	}
+}
+
+/**********************************************************************************************
+ * startMetrics - serves the metrics registry over HTTP on ip_addr:port, with the number of
+ *                clients connected and requests waiting for an answer added
+ *
+ *    Returns: false if the port can't be bound
+ **********************************************************************************************/
 
+bool TCPServer::startMetrics(const char *ip_addr, unsigned short port)
+{
+	Metrics::get().addCollector([this](std::string &out) {
+		std::lock_guard<std::mutex> lock(_clientsMutex);
+		size_t inFlight = 0;
+		for (auto &client : _clientMap)
+			inFlight += client.second->pendingRequests();
+
+		Metrics::appendHelp(out, "mainserver_clients_connected", "clients connected");
+		Metrics::appendLine(out, "mainserver_clients_connected", _clientMap.size());
+		Metrics::appendHelp(out, "mainserver_requests_in_flight", "requests sent to a coordinator and not yet answered");
+		Metrics::appendLine(out, "mainserver_requests_in_flight", inFlight);
+	});
+	return Metrics::get().serve(ip_addr, port);
 }
+
 /**********************************************************************************************
  * shutdown - Cleanly closes the socket FD.
  *
@@ -225,7 +522,9 @@ void TCPServer::listenToClients()
 void TCPServer::shutdown()
 {
 
-	_sockfd.closeFD();
-	_sockfd_coord.closeFD();
+	for (auto &worker : _workers)
+		worker->listenfd.closeFD();
+	for (auto &coord : _sockfd_coords)
+		coord->closeFD();
 }
 
@@ -14,7 +14,8 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " <ip_addr> <port>\n";
+   std::cout << execname << " <ip_addr> <port> [<upload_file>]\n";
+   std::cout << "   upload_file: file of numbers, one per line, to submit all at once\n";
 }
 
 
@@ -56,6 +57,9 @@ int main(int argc, char *argv[]) {
    cout << "Connection established.\n";
 
    try {
+      if (argc > 3)
+         client.uploadFile(argv[3]);
+
       client.handleConnection();
 
       client.closeConn();
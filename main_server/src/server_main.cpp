@@ -9,32 +9,45 @@
 #include <stdexcept>
 #include <iostream>
 #include <getopt.h>
+#include <vector>
 #include "TCPServer.h"
 #include "exceptions.h"
+#include "strfuncts.h"
+#include "Trace.h"
 
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " [-p <portnum>] [-a <ip_addr>]\n";
+   std::cout << execname << " [-p <portnum>] [-a <ip_addr>] [-c <ip_addr:port>[,<ip_addr:port>...]] [-w <workers>] [-T <trace_file>] [-M <metrics_port>]\n";
    std::cout << "   p: the port to bind the server to\n";
    std::cout << "   a: the IP address to bind the server\n";
+   std::cout << "   c: the coordinators to connect to; numbers are sharded across them\n";
+   std::cout << "   w: the number of threads accepting and handling clients\n";
+   std::cout << "   T: record a binary event trace of every request to this file (see tracemerge)\n";
+   std::cout << "   M: serve metrics over HTTP on this port (e.g. curl http://127.0.0.1:<port>/metrics)\n";
 
 }
 
 // global default values
 const unsigned short default_port = 5050;
 const char default_IP[] = "127.0.0.1";
+const char default_coordinators[] = "127.0.0.1:9999";
+const int default_workers = 1;
 
 int main(int argc, char *argv[]) {
 
 
    unsigned short port = default_port;
    std::string ip_addr(default_IP);
+   std::string coordinators(default_coordinators);
+   long workers = default_workers;
+   std::string trace_file;
+   long metrics_port = 0;
 
    // Get the command line arguments and set params appropriately
    int c = 0;
    long portval;
-   while ((c = getopt(argc, argv, "p:a:smw")) != -1) {
+   while ((c = getopt(argc, argv, "p:a:c:w:T:M:sm")) != -1) {
       switch (c) {
   
       // Set the max number to count up to	    
@@ -53,6 +66,34 @@ int main(int argc, char *argv[]) {
          ip_addr = optarg; 
          break;
 
+      // Coordinators to shard the numbers across
+      case 'c':
+         coordinators = optarg;
+         break;
+
+      // Client handling threads
+      case 'w':
+         workers = strtol(optarg, NULL, 10);
+         if ((workers < 1) || (workers > 256)) {
+            std::cout << "Invalid number of workers. Value must be between 1 and 256\n";
+            exit(0);
+         }
+         break;
+
+      // Event trace
+      case 'T':
+         trace_file = optarg;
+         break;
+
+      // Metrics endpoint
+      case 'M':
+         metrics_port = strtol(optarg, NULL, 10);
+         if ((metrics_port < 1) || (metrics_port > 65535)) {
+            std::cout << "Invalid metrics port. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         break;
+
       case '?':
 	      displayHelp(argv[0]);
 	      break;
@@ -67,6 +108,11 @@ int main(int argc, char *argv[]) {
 
    // Try to set up the server for listening
    TCPServer server;
+   server.setWorkers(workers);
+   if (trace_file.length() > 0)
+      Trace::get().open(trace_file, tc_main_server);
+   if (metrics_port > 0)
+      server.startMetrics(ip_addr.c_str(), (unsigned short) metrics_port);
    try {
       cout << "Binding server to " << ip_addr << " port " << port << endl;
       server.bindSvr(ip_addr.c_str(), port);
@@ -76,11 +122,30 @@ int main(int argc, char *argv[]) {
       cerr << "Server initialization failed: " << e.what() << endl;
       return -1;
    }	   
-   // Try to connect the server to the coordinator...
-   cout << "Connecting to the Coordinator \n";
-   server.connectToCoordinator("127.0.0.1", 9999);//this is just a stub for now
-
    try {
+      // Try to connect the server to each coordinator...
+      std::string left, right = coordinators;
+      while (right.length() > 0) {
+         if (!split(right, left, right, ',')) {
+            left = right;
+            right = "";
+         }
+
+         std::string coord_ip, coord_port;
+         if (!split(left, coord_ip, coord_port, ':')) {
+            cerr << "Invalid coordinator '" << left << "'. Format is <ip_addr:port>\n";
+            return -1;
+         }
+         portval = strtol(coord_port.c_str(), NULL, 10);
+         if ((portval < 1) || (portval > 65535)) {
+            cerr << "Invalid coordinator port. Value must be between 1 and 65535\n";
+            return -1;
+         }
+
+         cout << "Connecting to the Coordinator at " << left << "\n";
+         server.connectToCoordinator(coord_ip.c_str(), (unsigned short) portval);
+      }
+
       cout << "ListeningToClients\n";
       server.listenToClients();
       //cout << "ListeningToCoordinator.\n";
@@ -0,0 +1,115 @@
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <limits>
+
+/*
+ * Decimal conversion for unsigned integers of any width: uint64_t, unsigned __int128 or boost's
+ * fixed width uint128_t, uint256_t, ... Digits are handled 19 at a time in a uint64_t, so a wide
+ * integer does one wide multiply (parsing) or division (formatting) per 19 digits rather than
+ * one per digit, and nothing goes through iostreams.
+ */
+
+const int decimalChunkDigits = 19;
+const uint64_t decimalChunkBase = 10000000000000000000ull; // 10^19, the most a uint64_t chunk can hold
+
+// true if s is non-empty and digits only
+bool isDecimal(const std::string &s);
+
+// value of len (at most 19) digits, which the caller has checked are digits
+uint64_t parseDecimalChunk(const char *digits, size_t len);
+
+// appends value in decimal, zero padded to width digits (0 for no padding)
+void appendDecimalChunk(std::string &out, uint64_t value, int width);
+
+/*
+ * decimalPowers - 10^19, 10^38, 10^76, ... (10^(19 * 2^k)) for as long as they fit in a T
+ */
+template <typename T>
+const std::vector<T> &decimalPowers() {
+	static const std::vector<T> powers = [] {
+		std::vector<T> result(1, T(decimalChunkBase));
+		const T max = std::numeric_limits<T>::max();
+		while (result.back() <= max / result.back())
+			result.push_back(result.back() * result.back());
+		return result;
+	}();
+	return powers;
+}
+
+/*
+ * appendDecimal - appends value, which is below 10^(19 * 2^(level + 1)), splitting it in two
+ * around 10^(19 * 2^level) until the halves fit in a uint64_t. With pad set the result is zero
+ * padded to the full 19 * 2^(level + 1) digits, which is how the lower halves are written.
+ */
+template <typename T>
+void appendDecimal(std::string &out, const T &value, int level, bool pad) {
+	if (level < 0) {
+		appendDecimalChunk(out, static_cast<uint64_t>(value), pad ? decimalChunkDigits : 0);
+		return;
+	}
+
+	const T &power = decimalPowers<T>()[level];
+	if (!pad && value < power) {
+		appendDecimal(out, value, level - 1, false);
+		return;
+	}
+	appendDecimal(out, T(value / power), level - 1, pad);
+	appendDecimal(out, T(value % power), level - 1, true);
+}
+
+/*
+ * formatDecimal - value in decimal, without leading zeros
+ */
+template <typename T>
+std::string formatDecimal(const T &value) {
+	std::string out;
+	out.reserve(std::numeric_limits<T>::digits10 + 1);
+
+	// the largest power squared doesn't fit in a T, so value / largest power is below it
+	appendDecimal(out, value, (int) decimalPowers<T>().size() - 1, false);
+	return out;
+}
+
+/*
+ * parseDecimal - reads a string of decimal digits into value. Leading zeros are allowed.
+ *
+ * Returns: false, leaving value alone, if s is empty, has anything but digits in it or is too
+ *          big for T
+ */
+template <typename T>
+bool parseDecimal(const std::string &s, T &value) {
+	static_assert(std::numeric_limits<T>::digits >= 64, "parseDecimal needs at least 64 bit integers");
+	if (!isDecimal(s))
+		return false;
+
+	size_t start = s.find_first_not_of('0');
+	if (start == std::string::npos) {
+		value = 0;
+		return true;
+	}
+
+	// too big if it has more digits than the largest T, or as many and sorts after it
+	static const std::string max = formatDecimal(std::numeric_limits<T>::max());
+	size_t len = s.length() - start;
+	if (len > max.length() || (len == max.length() && s.compare(start, len, max) > 0))
+		return false;
+
+	// the first chunk takes the odd digits, so the rest are all full chunks
+	size_t first = len % decimalChunkDigits;
+	if (first == 0)
+		first = decimalChunkDigits;
+	T result = parseDecimalChunk(s.data() + start, first);
+	for (size_t pos = start + first; pos < s.length(); pos += decimalChunkDigits) {
+		result *= decimalChunkBase;
+		result += parseDecimalChunk(s.data() + pos, decimalChunkDigits);
+	}
+
+	value = result;
+	return true;
+}
+
+#endif
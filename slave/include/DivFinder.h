@@ -2,13 +2,56 @@
 #define POLRHO_H
 
 #include <list>
+#include <vector>
 #include <string>
+#include <mutex>
 #include <boost/multiprecision/cpp_int.hpp>
 #include <atomic>
+#include <random>
 #include "config.h"
+#include "FactorPolicy.h"
 
 using namespace boost::multiprecision;
 
+/******************************************************************************************
+ * FactorCheckpoint - snapshot of how far a factorization has got, so a job can be resumed
+ *                    on another slave node instead of starting over
+ *
+ *****************************************************************************************/
+
+struct FactorCheckpoint {
+   std::list<LARGEINT> primes;      // primes found so far
+   std::vector<LARGEINT> cofactors; // parts of the original number still to be factored
+   LARGEINT walk_n = 0;             // cofactor the rho walk below is running on (0 if none)
+   LARGEINT walk_x = 0;
+   LARGEINT walk_y = 0;
+   LARGEINT walk_c = 0;
+   unsigned long version = 0;       // bumped every time the state changes
+};
+
+/******************************************************************************************
+ * FactorResult - what PolRho hands back for a job
+ *
+ *****************************************************************************************/
+
+struct FactorResult {
+   std::list<LARGEINT> primes;           // primes found
+   std::vector<LARGEINT> unfactored;     // cofactors left when the budget ran out
+   std::vector<FactorMethod> methods;    // methods that split a cofactor, in the order first used
+};
+
+// Trial division (the trial method) stops at this divisor
+const uint64_t trial_division_limit = 1 << 16;
+
+// Brent's rho multiplies this many differences together before taking a gcd
+const unsigned int brent_batch = 128;
+
+// p - 1 takes a gcd every this many primes
+const unsigned int pm1_batch = 64;
+
+// Primes are sieved up to here for ECM and p - 1; no stage bound goes beyond it
+const uint32_t prime_table_limit = 300000;
+
 /******************************************************************************************
  * DivFinder - Parent class for a set of single-process and multithreaded methods for finding
  *             prime numbers
@@ -28,29 +71,114 @@ class DivFinder {
       DivFinder(LARGEINT input_value);
       virtual ~DivFinder();
 
-      // Overload me 
-      virtual void PolRho(std::list<LARGEINT> &prime_factors) = 0;
+      // Overload me. Fills in the primes, or on running out of budget (see setBudget) the
+      // primes found so far plus the cofactors left unfactored
+      virtual void PolRho(FactorResult &result) = 0;
 
       LARGEINT getOrigVal() { return _orig_val; }
 
+      // Readies this finder for another number, so one can be reused from job to job
+      void reset(LARGEINT input_value);
+
       virtual void combinePrimes(std::list<LARGEINT> &dest);
+
+      // Divisor finding methods. Each makes one attempt at a divisor of n and returns it, or n
+      // if the attempt failed and is worth repeating (new random start or curve), or 0 if it
+      // was stopped by a cancel, the budget or the end of its time slice
       LARGEINT calcPollardsRho(LARGEINT n);
+      LARGEINT calcBrentRho(LARGEINT n);
+      uint64_t calcPollardsRho64(uint64_t n);
+      LARGEINT calcECM(LARGEINT n);
+
+      // Deterministic methods for cofactors that fit in 64 bits. Each returns a divisor of n,
+      // 1 if it has run its course without one, or 0 if it was stopped
+      uint64_t calcSQUFOF(uint64_t n);
+      uint64_t calcHartOLF(uint64_t n);
+      LARGEINT calcPollardPM1(LARGEINT n);
+
+      // Smallest divisor of n up to limit, n if there is none, or 0 if stopped
+      LARGEINT calcTrialDivision(LARGEINT n, uint64_t limit);
+
+      // Miller-Rabin on the first 16 primes: exact below 3.3 * 10^24, and for wider n the
+      // chance of a composite passing is far below that of a hardware error
+      bool isProbablePrime(LARGEINT n);
+
+      // Which methods to use on a cofactor of a given size. Not owned; nullptr for the default
+      void setPolicy(const FactorPolicy *policy);
 
       void setVerbose(int lvl);
 
+      // Seeds the random starting points of the rho walks. Copies of the same job running on
+      // different slave nodes are given different seeds so they don't repeat each other's work
+      void setSeed(unsigned long seed);
+
       void cancel_op();
 
+      // Limits the next PolRho to a deadline (steady clock nanoseconds) and/or a number of rho
+      // iterations and trial divisions, 0 for no limit. Running out stops the work like a
+      // cancel, but what was found is kept
+      void setBudget(int64_t deadline_ns, unsigned long iterations);
+
+      // Thread safe snapshot of the factoring state, and loading one to pick up where it left off
+      FactorCheckpoint getCheckpoint();
+      void resumeFrom(const FactorCheckpoint &checkpoint);
+
    protected:
 
       LARGEINT2X modularPow(LARGEINT2X base, int exponent, LARGEINT2X modulus);
 
+      // calcPollardPM1 on a LARGEINT or a uint64_t
+      template <typename T>
+      T runPollardPM1(const T &n, uint64_t b1, uint64_t b2);
+
       std::list<LARGEINT> primes;
+
+      // Cofactors still to be factored; the back is the one being worked on
+      std::vector<LARGEINT> pending;
+
+      // Rho walk state published every walk_publish_interval iterations for checkpoints. A
+      // walk loaded by resumeFrom is picked back up by calcPollardsRho if its n matches
+      LARGEINT walk_n = 0, walk_x = 0, walk_y = 0, walk_c = 0;
+      const unsigned int walk_publish_interval = 1024;
+      bool resumed = false;
+      unsigned long state_version = 0;
+      std::mutex state_mtx; // guards primes, pending and the walk state
+
+      // Stops handing out the walk on n once a rho or Brent stage is over, found or not
+      void finishWalk(const LARGEINT &n);
 		
       int verbose = 0;
       
+      // Long running loops call checkBool at least this often, so a cancel takes effect
+      // within a bounded amount of work rather than when the loop happens to finish
+      static const unsigned int cancel_check_interval = 4096;
+
+      const FactorPolicy *policy = nullptr;
+
+      // methods that split a cofactor in this PolRho, for the result
+      std::vector<FactorMethod> methods_used;
+      void recordMethod(FactorMethod method);
+
+      // Time slice of the policy step running now (0 for none); shouldStop notices when it ends
+      int64_t stage_deadline_ns = 0;
+      unsigned long stage_clock_checked_at = 0;
+      bool stage_expired = false;
+      void startStage(unsigned int timeMs);
+      bool shouldStop();
+
+      // Budget for the current PolRho; checkBool notices when it runs out
+      int64_t budget_deadline_ns = 0;
+      unsigned long budget_iterations = 0;
+      unsigned long iterations_done = 0;
+      unsigned long clock_checked_at = 0;  // iterations_done when the clock was last read
+      static const unsigned int budget_clock_interval = 256;
+      bool budget_exhausted = false;
+
       bool checkBool();
       void clean_up();
       std::atomic<bool> cancel_bool{false};
+      std::mt19937_64 rng{std::random_device{}()};
+      unsigned long seed = 0; // identifies the job in the event trace
 
       // Do not forget, your constructor should call this constructor
 
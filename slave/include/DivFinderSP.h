@@ -7,9 +7,6 @@
 #include <boost/math/common_factor.hpp>
 #include <atomic>
 
-// If factor has been called on a number x times, check to see if the number is prime
-const unsigned int primecheck_depth = 10;
-
 /******************************************************************************************
  * DivFinderSP - Used as a recursive calculator for prime numbers using Pollards Rho algorithm.
  *            A simple, recursive single process/thread version.
@@ -17,9 +14,8 @@ const unsigned int primecheck_depth = 10;
  *  	   DivFinder(Const): 
  *  	   ~DivFinder(Dest):
  *
- *         PolRho - function that executes the stochastic Pollards' Rho algorithm for finding
- *                  divisors
- *         ifPrimeBF - uses brute force using 6k+-1 optimization to determine if a number is prime
+ *         PolRho - factors the number, choosing a method for each cofactor by its size
+ *                  from the factoring policy (see FactorPolicy)
  *
  *  	   Exceptions: sub-classes should throw a std::exception with the what string field
  *  	               populated for any issues.
@@ -31,14 +27,14 @@ class DivFinderSP : public DivFinder {
       DivFinderSP(LARGEINT input_value);
       virtual ~DivFinderSP();
 
-      virtual void PolRho(std::list<LARGEINT> &prime_factors) override;
-
-      bool isPrimeBF(LARGEINT n, LARGEINT &divisor);
+      virtual void PolRho(FactorResult &result) override;
 
 
    protected:
       void factor();
       void factor(LARGEINT n);
+      void factorPending();
+      LARGEINT findDivisor(LARGEINT n);
 
       
 
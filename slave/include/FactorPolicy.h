@@ -0,0 +1,67 @@
+#ifndef FACTORPOLICY_H
+#define FACTORPOLICY_H
+
+#include <string>
+#include <vector>
+
+/******************************************************************************************
+ * FactorMethod - the ways DivFinderSP can look for a divisor of a cofactor
+ *
+ *****************************************************************************************/
+
+enum FactorMethod {
+   fm_trial,      // trial division by 2, 3 and 6k +/- 1 up to trial_division_limit
+   fm_rho,        // Floyd's Pollard rho on LARGEINT2X arithmetic, the original method
+   fm_rho64,      // Brent's rho on native 64 bit integers, for cofactors that fit in 64 bits
+   fm_brent,      // Brent's rho on LARGEINT2X arithmetic, a gcd per batch of steps
+   fm_ecm,        // Lenstra's elliptic curve method (stage 1) on Montgomery curves
+   fm_squfof,     // Shanks' square forms factorization with multipliers, up to 64 bits
+   fm_hart,       // Hart's one line factoring, up to 64 bits
+   fm_pm1,        // Pollard's p - 1, stages 1 and 2
+   fm_count
+};
+
+// One entry of a policy row: a method and how long (ms) it may work on a cofactor before
+// the next step takes over. The last step of a row runs until the cofactor is split
+struct FactorStep {
+   FactorMethod method;
+   unsigned int timeMs;
+};
+
+/******************************************************************************************
+ * FactorPolicy - which methods are tried on a cofactor, by its bit length. Each row covers
+ *                cofactors up to maxBits wide; the last row also takes anything wider.
+ *
+ *         load - replaces the table with one read from a file, one row per line:
+ *                   <max bits> <method>[:<ms>] <method>[:<ms>] ...
+ *                Blank lines and anything after a # are ignored. Returns false with error
+ *                set if the file can't be read or a line doesn't parse; the table is then
+ *                left as it was
+ *         stepsFor - the steps for a cofactor this many bits wide
+ *         methods - the methods the table uses, comma separated, for the REGISTER message
+ *         describe - the table on one line, for logging
+ *
+ *****************************************************************************************/
+
+class FactorPolicy {
+   public:
+      FactorPolicy();
+
+      bool load(const std::string &path, std::string &error);
+      const std::vector<FactorStep> &stepsFor(int bits) const;
+      std::string methods() const;
+      std::string describe() const;
+
+      static const char *methodName(FactorMethod method);
+      static bool parseMethod(const std::string &name, FactorMethod &method);
+
+   private:
+      struct Row {
+         int maxBits;
+         std::vector<FactorStep> steps;
+      };
+
+      std::vector<Row> rows;   // ascending maxBits
+};
+
+#endif
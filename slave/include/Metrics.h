@@ -0,0 +1,85 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+/*
+ * Counter - a count that only goes up. Lock-free; safe to add to from any thread.
+ */
+class Counter {
+	public:
+		void add(uint64_t n = 1) { count.fetch_add(n, std::memory_order_relaxed); };
+		uint64_t value() { return count.load(std::memory_order_relaxed); };
+	private:
+		std::atomic<uint64_t> count{0};
+};
+
+/*
+ * Histogram - distribution of non-negative integer samples (e.g. microseconds). Buckets are
+ * log-linear like an HDR histogram: values below 16 get a bucket each, and every power of two
+ * above that is split into 8 buckets, so a percentile is within 12.5% of the true value whatever
+ * its size. Recording is lock-free.
+ */
+class Histogram {
+	public:
+		void record(uint64_t value);
+		uint64_t count() { return samples.load(std::memory_order_relaxed); };
+		uint64_t sum() { return total.load(std::memory_order_relaxed); };
+		uint64_t max() { return largest.load(std::memory_order_relaxed); };
+		uint64_t percentile(double p);
+
+	private:
+		static const int linearBuckets = 16;
+		static const int subBuckets = 8;
+		static const int numBuckets = linearBuckets + (64 - 4) * subBuckets;
+
+		static int bucketOf(uint64_t value);
+		static uint64_t bucketTop(int bucket);
+
+		std::atomic<uint64_t> buckets[numBuckets] = {};
+		std::atomic<uint64_t> samples{0};
+		std::atomic<uint64_t> total{0};
+		std::atomic<uint64_t> largest{0};
+};
+
+/*
+ * Metrics - the process-wide registry of counters and histograms. Values that are cheaper to
+ * compute when asked for (queue depths, ratios) are supplied by collectors, which append their
+ * own lines. render() produces plain text, one "name value" per line; serve() makes it
+ * available over HTTP on a local port, for curl or a Prometheus scraper.
+ */
+class Metrics {
+	public:
+		static Metrics& get();
+
+		// the same name always returns the same object
+		Counter& counter(const std::string& name, const std::string& help);
+		Histogram& histogram(const std::string& name, const std::string& help);
+		void addCollector(std::function<void(std::string&)> collector);
+
+		std::string render();
+		bool serve(const char* ipAddr, unsigned short port);
+
+		// helpers for collectors
+		static void appendLine(std::string& out, const std::string& name, double value);
+		static void appendHelp(std::string& out, const std::string& name, const std::string& help);
+
+	private:
+		Metrics() {}
+
+		std::mutex registryMutex;
+		std::map<std::string, std::pair<std::string, std::unique_ptr<Counter>>> counters;
+		std::map<std::string, std::pair<std::string, std::unique_ptr<Histogram>>> histograms;
+		std::vector<std::function<void(std::string&)>> collectors;
+
+		void serveThread(int listenFd);
+};
+
+#endif
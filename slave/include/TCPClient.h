@@ -16,10 +16,12 @@
 #include <boost/multiprecision/cpp_int.hpp>
 #include <atomic>
 #include <list>
+#include <map>
 #include <thread>
 #include <condition_variable>
 #include "config.h"
 #include "DivFinderSP.h"
+#include "WorkerPool.h"
 
 // The amount to read in before we send a packet
 const unsigned int stdin_bufsize = 50;
@@ -31,8 +33,12 @@ public:
    TCPClient();
    ~TCPClient();
 	bool sendData(std::string data);
-	std::string receiveData();
+	void queueMessage(const std::string &message);
+	ssize_t receiveData(std::string &buf);
 	void receivingThread();
+	void setHeartbeatTimeout(int timeoutMs);
+	bool heartbeatExpired();
+	std::chrono::milliseconds heartbeatWait();
 	void sendingThread();
 	std::string sanitizeUserInput(const std::string& s);
 
@@ -44,17 +50,22 @@ public:
    protected:
    	std::queue<std::string> receivedMessages;
 	std::queue<std::string> sendMessages;
-	bool connClosed = false;
-	bool connectionBroke = false;
+	std::atomic<bool> connClosed{false};
+	std::atomic<bool> connectionBroke{false};
 	std::mutex mtx1;
+	std::condition_variable wakeup; // with mtx1; signalled when a message arrives or the connection breaks
 	std::mutex mtx_send;
+	std::condition_variable sendReady; // with mtx_send; signalled when a message is queued or the connection breaks
+	int heartbeatTimeoutMs = 8000; // how long we wait for a heartbeat from the server before giving up on it
 
 private:
 	 sockaddr_in sockaddr;
 	 int sockfd;
 	 struct sockaddr_in server;
      bool clientTestMode = false; // used to test setting client IP address to static ip addr
-	 std::chrono::system_clock::time_point lastTimeHeartBeatReceived = std::chrono::system_clock::now();;
+	 std::chrono::system_clock::time_point lastTimeHeartBeatReceived = std::chrono::system_clock::now();
+	 bool heartBeatSeen = false; // servers that never send heartbeats are never timed out
+	 std::string pendingReceived; // received data that doesn't yet form a full newline terminated message
 
 };
 
@@ -63,23 +74,44 @@ using namespace boost::multiprecision;
 class Slave : public TCPClient
 {
 public:
-	Slave():TCPClient() {}
+	Slave(unsigned int maxJobs = 0, const FactorPolicy &policy = FactorPolicy()); // 0 runs a job per core
+	void connectTo(const char *ip_addr, unsigned short port);
 	void factorNumber(LARGEINT n);
 	void handleConnection();
 	void handleMessage(std::string msg);
 	LARGEINT strtoLARGE(std::string str_num);
 	std::string LARGEtostr(LARGEINT i);
 
+	// capability announcement sent to the coordinator when we connect
+	std::string buildRegisterMessage();
+	double runBenchmark();
+
+	// checkpoints let the coordinator resume our jobs elsewhere if we die
+	void sendCheckpoints();
+	std::string buildCheckpointFields(const FactorCheckpoint &checkpoint);
+	FactorCheckpoint parseCheckpointFields(const std::string &primes, const std::string &cofactors, const std::string &walk);
+
+	// serves the metrics registry over HTTP, with how busy this slave node is added
+	bool startMetrics(const char *ip_addr, unsigned short port);
+
 private:
-	int client_ID;
-	int slave_ID;
-	LARGEINT num_to_factor;
-	DivFinderSP* slave_div = nullptr;
-	std::atomic<bool> cancel_op{false};
-	std::thread div_thread;
-	std::list<LARGEINT> prime_factors;
-	std::condition_variable cv;
-	std::mutex cancel_mtx;
+	// jobs sent to us that haven't ended yet, by the coordinator's job id. Each runs on its own
+	// worker with its own cancellation flag and result, and is answered on its own
+	struct RunningJob {
+		FactorJob job;
+		unsigned long checkpointVersion = 0; // version of the last checkpoint sent for it
+	};
+	std::map<unsigned long, RunningJob> running_jobs;
+	std::mutex jobs_mtx; // guards running_jobs; jobs end on the workers' threads
+	void jobDone(const FactorJob &job, FactorResult &result, bool cancelled);
+	int checkpoint_interval_ms = 2000; // how often we report progress on running jobs
+	std::chrono::steady_clock::time_point last_checkpoint = std::chrono::steady_clock::now();
+
+	// when we started, in nanoseconds on the steady clock, for the busy ratio
+	int64_t slave_started = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	// declared last so its workers stop before the rest of the slave is torn down
+	WorkerPool pool;
 };
 
 
@@ -65,7 +65,6 @@ private:
 
  int numberOfJobsPerClientReq = 2; // number of jobs for each client request (TODO: need to change this to be based on the number of slave nodes!!!)
 
- std::mutex m1; // lock for logger
  void log(const char *msg);
  void log(std::string msg);
 
@@ -0,0 +1,87 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include "DivFinderSP.h"
+
+/******************************************************************************************
+ * FactorJob - one POLLARD_REQ as handed to the worker pool
+ *
+ *****************************************************************************************/
+
+struct FactorJob {
+   unsigned long id = 0;          // assigned by the slave, used to cancel or checkpoint the job
+   int clientId = 0;
+   int slaveId = 0;
+   unsigned long seed = 0;        // 0 leaves the worker's random number generator as it is
+   LARGEINT number = 0;
+   bool resume = false;           // pick up from checkpoint instead of starting over
+   FactorCheckpoint checkpoint;
+   unsigned long budgetMs = 0;    // answer with what's been found this long after arriving (0 for no limit)
+   unsigned long budgetIterations = 0; // or after this many rho iterations and trial divisions
+   int64_t queuedNs = 0;          // steady clock, for the job duration metric and the time budget
+};
+
+/******************************************************************************************
+ * WorkerPool - long-lived factoring threads, each with a DivFinderSP it reuses from job to
+ *              job, fed through a queue. A job is started by the first idle worker; when it
+ *              ends, the pool calls the done handler on that worker's thread with the primes
+ *              found (empty if the job was cancelled), the methods that found them and, if it
+ *              ran out of budget, the cofactors it didn't get to. Every worker factors by the
+ *              pool's copy of the factoring policy.
+ *
+ *         submit - queues a job
+ *         cancel - stops a job whether it's queued or running. Returns false if the job
+ *                  isn't known (it may have just finished)
+ *         getCheckpoint - the progress of a running job. Returns false if it isn't running
+ *
+ *****************************************************************************************/
+
+class WorkerPool {
+   public:
+      typedef std::function<void(const FactorJob &job, FactorResult &result, bool cancelled)> DoneHandler;
+
+      WorkerPool(unsigned int workers, const FactorPolicy &policy, DoneHandler onDone);
+      ~WorkerPool();
+
+      void submit(const FactorJob &job);
+      bool cancel(unsigned long jobId);
+      bool getCheckpoint(unsigned long jobId, FactorCheckpoint &checkpoint);
+
+      unsigned int size() { return (unsigned int) workers.size(); };
+      const FactorPolicy &getPolicy() { return policy; };
+
+      // nanoseconds (steady clock) spent running jobs so far, including the ones running now
+      int64_t busyNs();
+
+   private:
+      struct Worker {
+         DivFinderSP context{0};
+         std::thread thread;
+         unsigned long jobId = 0;   // running job, 0 while idle
+         bool cancelled = false;
+         int64_t startedNs = 0;
+         int64_t cancelledNs = 0;   // when cancel was called, for the cancel latency metric
+      };
+
+      void workerThread(Worker *worker);
+
+      std::vector<std::unique_ptr<Worker>> workers;
+      std::deque<FactorJob> queue;
+      std::mutex mtx;               // guards queue and the workers' job state
+      std::condition_variable jobReady;
+      bool stopping = false;
+      FactorPolicy policy;          // declared before the workers, which point at it
+      DoneHandler onDone;
+      std::atomic<int64_t> finishedNs{0};
+};
+
+#endif
@@ -0,0 +1,46 @@
+#include "Decimal.h"
+
+bool isDecimal(const std::string &s) {
+	if (s.empty())
+		return false;
+	for (char c : s)
+		if (c < '0' || c > '9')
+			return false;
+	return true;
+}
+
+uint64_t parseDecimalChunk(const char *digits, size_t len) {
+	uint64_t value = 0;
+	for (size_t i = 0; i < len; i++)
+		value = value * 10 + (uint64_t) (digits[i] - '0');
+	return value;
+}
+
+/*
+ * Digits are written two at a time from a table, back to front into a buffer.
+ */
+void appendDecimalChunk(std::string &out, uint64_t value, int width) {
+	static const char pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+	char buf[24];
+	char *end = buf + sizeof(buf), *p = end;
+	while (value >= 100) {
+		unsigned int pair = (unsigned int) (value % 100) * 2;
+		value /= 100;
+		*--p = pairs[pair + 1];
+		*--p = pairs[pair];
+	}
+	if (value >= 10) {
+		*--p = pairs[value * 2 + 1];
+		*--p = pairs[value * 2];
+	} else {
+		*--p = (char) ('0' + value);
+	}
+
+	while (end - p < width)
+		*--p = '0';
+	out.append(p, end - p);
+}
@@ -1,6 +1,31 @@
 #include "DivFinder.h"
 #include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <boost/integer/common_factor.hpp>
 #include "config.h"
+#include "Metrics.h"
+
+static Counter &rhoIterations = Metrics::get().counter("slave_rho_iterations_total", "Pollard's rho iterations run");
+
+// one counter per method of the divisors it found, e.g. slave_divisors_found_ecm_total
+static Counter &divisorsFound(FactorMethod method) {
+   static const std::vector<Counter *> counters = [] {
+      std::vector<Counter *> result;
+      for (int i = 0; i < fm_count; i++) {
+         std::string name = FactorPolicy::methodName((FactorMethod) i);
+         result.push_back(&Metrics::get().counter("slave_divisors_found_" + name + "_total", "divisors found by the " + name + " method"));
+      }
+      return result;
+   }();
+   return *counters[method];
+}
+
+static int64_t steadyNs() {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 DivFinder::DivFinder(LARGEINT number):_orig_val(number) {
 }
@@ -8,12 +33,23 @@ DivFinder::DivFinder(LARGEINT number):_orig_val(number) {
 DivFinder::~DivFinder() {
 }
 
+void DivFinder::reset(LARGEINT input_value) {
+   clean_up();
+   _orig_val = input_value;
+   seed = 0;
+}
+
 void DivFinder::setVerbose(int lvl) {
    if ((lvl < 0) || (lvl > 3))
       throw std::runtime_error("Attempt to set invalid verbosity level. Lvl: (0-3)\n");
    verbose = lvl;
 }
 
+void DivFinder::setSeed(unsigned long seed) {
+   this->seed = seed;
+   rng.seed(seed);
+}
+
 /********************************************************************************************
  * modularPow - function to gradually calculate (x^n)%m to avoid overflow issues for
  *              very large non-prime numbers using the stl function pow (floats)
@@ -57,23 +93,44 @@ LARGEINT DivFinder::calcPollardsRho(LARGEINT n) {
    if (n <= 3)
       return n;
 
-   // Initialize our random number generator
-   srand(time(NULL));
-
    // pick a random number from the range [2, N)
-   LARGEINT2X x = (rand()%(n-2)) + 2;
+   LARGEINT2X x = (rng()%(n-2)) + 2;
    LARGEINT2X y = x;    // Per the algorithm
 
    // random number for c = [1, N)
-   LARGEINT2X c = (rand()%(n-1)) + 1;
+   LARGEINT2X c = (rng()%(n-1)) + 1;
+
+   // pick up a walk on this number that was running when the job was checkpointed
+   state_mtx.lock();
+   if (walk_n == n) {
+      x = walk_x;
+      y = walk_y;
+      c = walk_c;
+   }
+   state_mtx.unlock();
 
    LARGEINT2X d = 1;
+   unsigned int iters = 0;
 
    // Loop until either we find the gcd or gcd = 1
    while (d == 1) {
-      if(checkBool()){
+      if(shouldStop()){
+         rhoIterations.add(iters % walk_publish_interval);
+         finishWalk(n);
          return 0;
       }
+
+      iterations_done++;
+      if (++iters % walk_publish_interval == 0) {
+         rhoIterations.add(walk_publish_interval);
+         std::lock_guard<std::mutex> lock(state_mtx);
+         walk_n = n;
+         walk_x = (LARGEINT) x;
+         walk_y = (LARGEINT) y;
+         walk_c = (LARGEINT) c;
+         state_version++;
+      }
+
       // "Tortoise move" - Update x to f(x) (modulo n)
       // f(x) = x^2 + c f
       x = (modularPow(x, 2, n) + c + n) % n;
@@ -91,14 +148,712 @@ LARGEINT DivFinder::calcPollardsRho(LARGEINT n) {
 
       // If we found a divisor, factor primes out of each side of the divisor
       if ((d != 1) && (d != n)) {
-         return (LARGEINT) d;
-
+         break;
       }
 
    }
+
+   rhoIterations.add(iters % walk_publish_interval);
+   finishWalk(n);
    return (LARGEINT) d;
 }
 
+/**********************************************************************************************
+ * finishWalk - called when a rho or Brent walk on n ends, whether it found a divisor or was
+ *              stopped. The walk is over, so a checkpoint shouldn't hand it out any more
+ **********************************************************************************************/
+
+void DivFinder::finishWalk(const LARGEINT &n) {
+   std::lock_guard<std::mutex> lock(state_mtx);
+   if (walk_n == n)
+      walk_n = 0;
+}
+
+
+/**********************************************************************************************
+ * Modular arithmetic for the methods below. Products are taken in LARGEINT2X (or 128 bits for
+ * the 64 bit versions) so they can't overflow, and sums are arranged to stay below n
+ **********************************************************************************************/
+
+static LARGEINT mulMod(const LARGEINT &a, const LARGEINT &b, const LARGEINT &n) {
+   return (LARGEINT) (((LARGEINT2X) a * (LARGEINT2X) b) % n);
+}
+
+static LARGEINT addMod(const LARGEINT &a, const LARGEINT &b, const LARGEINT &n) {
+   return a >= n - b ? (LARGEINT) (a - (n - b)) : (LARGEINT) (a + b);
+}
+
+static LARGEINT subMod(const LARGEINT &a, const LARGEINT &b, const LARGEINT &n) {
+   return a >= b ? (LARGEINT) (a - b) : (LARGEINT) (a + (n - b));
+}
+
+static LARGEINT powMod(LARGEINT base, LARGEINT exponent, const LARGEINT &n) {
+   LARGEINT result = 1;
+   while (exponent > 0) {
+      if ((exponent & 1) != 0)
+         result = mulMod(result, base, n);
+      exponent >>= 1;
+      base = mulMod(base, base, n);
+   }
+   return result;
+}
+
+static uint64_t mulMod(uint64_t a, uint64_t b, uint64_t n) {
+   return (uint64_t) ((unsigned __int128) a * b % n);
+}
+
+static uint64_t powMod(uint64_t base, uint64_t exponent, uint64_t n) {
+   uint64_t result = 1;
+   while (exponent > 0) {
+      if (exponent & 1)
+         result = mulMod(result, base, n);
+      exponent >>= 1;
+      base = mulMod(base, base, n);
+   }
+   return result;
+}
+
+// The primes up to prime_table_limit, for the stage bounds of ECM and p - 1
+static const std::vector<uint32_t> &sievedPrimes() {
+   static const std::vector<uint32_t> primes = [] {
+      std::vector<bool> composite(prime_table_limit + 1);
+      std::vector<uint32_t> result;
+      for (uint32_t i = 2; i <= prime_table_limit; i++) {
+         if (composite[i])
+            continue;
+         result.push_back(i);
+         for (uint64_t j = (uint64_t) i * i; j <= prime_table_limit; j += i)
+            composite[j] = true;
+      }
+      return result;
+   }();
+   return primes;
+}
+
+static const unsigned int smallPrimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+
+// Miller-Rabin with the small primes as bases, for an odd n above all of them
+template <typename T>
+static bool millerRabin(const T &n) {
+   T d = n - 1;
+   unsigned int s = 0;
+   while ((d & 1) == 0) {
+      d >>= 1;
+      s++;
+   }
+
+   for (unsigned int base : smallPrimes) {
+      T x = powMod(T(base), d, n);
+      if (x == 1 || x == n - 1)
+         continue;
+
+      unsigned int i = 1;
+      for (; i < s; i++) {
+         x = mulMod(x, x, n);
+         if (x == n - 1)
+            break;
+      }
+      if (i == s)
+         return false;   // base is a witness that n is composite
+   }
+   return true;
+}
+
+bool DivFinder::isProbablePrime(LARGEINT n) {
+   if (n < 2)
+      return false;
+   for (unsigned int prime : smallPrimes)
+      if (n % prime == 0)
+         return n == prime;
+
+   if (n <= std::numeric_limits<uint64_t>::max())
+      return millerRabin((uint64_t) n);
+   return millerRabin(n);
+}
+
+/**********************************************************************************************
+ * calcTrialDivision - tries 2, 3 and then 6k +/- 1 up to limit (or the square root of n if
+ *                     that is smaller). Checks for a stop every cancel_check_interval rounds
+ *
+ *    Returns: the smallest divisor found, n if there is none up to limit, 0 if stopped
+ **********************************************************************************************/
+
+LARGEINT DivFinder::calcTrialDivision(LARGEINT n, uint64_t limit) {
+   if (limit >= 2 && n > 2 && n % 2 == 0)
+      return 2;
+   if (limit >= 3 && n > 3 && n % 3 == 0)
+      return 3;
+
+   // every composite has a divisor no bigger than its square root, which fits in 64 bits
+   uint64_t last = (uint64_t) std::min((LARGEINT) limit, (LARGEINT) sqrt(n));
+
+   // native division is much cheaper when n fits in 64 bits
+   bool narrow = n <= std::numeric_limits<uint64_t>::max();
+   uint64_t n64 = narrow ? (uint64_t) n : 0;
+
+   unsigned int checked = 0;
+   for (uint64_t k = 5; k <= last; k += 6) {
+      if ((narrow ? n64 % k : (uint64_t) (n % k)) == 0)
+         return k;
+      if (k + 2 <= last && (narrow ? n64 % (k + 2) : (uint64_t) (n % (k + 2))) == 0)
+         return k + 2;
+
+      if (++checked == cancel_check_interval) {
+         iterations_done += cancel_check_interval;
+         if (shouldStop())
+            return 0;
+         checked = 0;
+      }
+      if (last - k < 6)
+         break;   // k + 6 would pass last, and might wrap around
+   }
+   return n;
+}
+
+/**********************************************************************************************
+ * calcPollardsRho64 - Brent's variant of Pollard's rho on native integers: the walk is compared
+ *                     against a fixed point that moves at powers of two instead of running a
+ *                     second walk, and the differences are multiplied together so there is one
+ *                     gcd per brent_batch steps. If a batch overshoots (the product goes to 0)
+ *                     it is replayed a step at a time
+ *
+ *    Params:  n - odd composite that fits in 64 bits
+ *
+ *    Returns: a divisor if found, n if the walk cycled without one, 0 if stopped
+ **********************************************************************************************/
+
+uint64_t DivFinder::calcPollardsRho64(uint64_t n) {
+   if (n % 2 == 0)
+      return 2;
+
+   uint64_t c = rng() % (n - 1) + 1;
+   uint64_t y = rng() % n;
+   auto next = [n, c](uint64_t v) { return (uint64_t) (((unsigned __int128) v * v + c) % n); };
+   auto distance = [](uint64_t a, uint64_t b) { return a > b ? a - b : b - a; };
+
+   uint64_t x = y, ys = y, q = 1, g = 1;
+   for (uint64_t r = 1; g == 1; r *= 2) {
+      x = y;
+      for (uint64_t i = 1; i <= r; i++) {
+         y = next(y);
+         if (i % brent_batch == 0 && shouldStop())
+            return 0;
+      }
+      iterations_done += r;
+      rhoIterations.add(r);
+
+      for (uint64_t k = 0; k < r && g == 1; k += brent_batch) {
+         if (shouldStop())
+            return 0;
+         ys = y;
+         uint64_t steps = std::min((uint64_t) brent_batch, r - k);
+         for (uint64_t i = 0; i < steps; i++) {
+            y = next(y);
+            q = mulMod(q, distance(x, y), n);
+         }
+         iterations_done += steps;
+         rhoIterations.add(steps);
+         g = boost::integer::gcd(q, n);
+      }
+   }
+
+   if (g == n) {
+      do {
+         ys = next(ys);
+         g = boost::integer::gcd(distance(x, ys), n);
+      } while (g == 1);
+   }
+   return g;
+}
+
+/**********************************************************************************************
+ * Square roots for SQUFOF and Hart's method. A double holds integers below 2^52 exactly and
+ * its square root is then right to the integer; above that the estimate can be off by one
+ * either way, so it is corrected with exact integer arithmetic
+ **********************************************************************************************/
+
+static uint64_t isqrt(unsigned __int128 x) {
+   if (x < (1ull << 52))
+      return (uint64_t) std::sqrt((double) x);
+
+   uint64_t r = (uint64_t) sqrtl((long double) x);
+   while ((unsigned __int128) r * r > x)
+      r--;
+   while ((unsigned __int128) (r + 1) * (r + 1) <= x)
+      r++;
+   return r;
+}
+
+// true, with root set, if x is a perfect square. Squares take only 12 of the 64 values mod 64,
+// so most x are turned away before the square root
+static bool isSquare(uint64_t x, uint64_t &root) {
+   static const uint64_t squaresMod64 = [] {
+      uint64_t mask = 0;
+      for (unsigned int i = 0; i < 64; i++)
+         mask |= 1ull << (i * i % 64);
+      return mask;
+   }();
+   if (((squaresMod64 >> (x & 63)) & 1) == 0)
+      return false;
+   root = isqrt(x);
+   return root * root == x;
+}
+
+// Multipliers for SQUFOF, tried in turn; products of small odd primes, so kn stays odd
+static const uint32_t squfofMultipliers[] = { 1, 3, 5, 7, 11, 3*5, 3*7, 3*11, 5*7, 5*11, 7*11,
+                                              3*5*7, 3*5*11, 3*7*11, 5*7*11, 3*5*7*11 };
+
+/**********************************************************************************************
+ * calcSQUFOF - Shanks' square forms factorization: expands the continued fraction of sqrt(kn)
+ *              until one of its Q values at an even step is a perfect square, then walks the
+ *              reduced form from that square root until P repeats, where Q shares a factor
+ *              with n. It takes about n^(1/4) steps whatever the size of the factors. kn needs
+ *              up to 75 bits, so it is kept in 128, but everything worked out from it stays
+ *              below 2 sqrt(kn) and fits in 64. A multiplier k that doesn't work out is
+ *              followed by the next one
+ *
+ *    Params:  n - odd composite that fits in 64 bits
+ *
+ *    Returns: a divisor if found, 1 if every multiplier failed, 0 if stopped
+ **********************************************************************************************/
+
+uint64_t DivFinder::calcSQUFOF(uint64_t n) {
+   if (n % 2 == 0)
+      return 2;
+
+   // the multipliers' primes would otherwise come back as "factors"
+   uint64_t g = boost::integer::gcd(n, (uint64_t) (3*5*7*11));
+   if (g != 1 && g != n)
+      return g;
+
+   uint64_t root = isqrt(n);
+   if (root * root == n)
+      return root;
+
+   unsigned int checked = 0;
+   for (uint32_t k : squfofMultipliers) {
+      unsigned __int128 kn = (unsigned __int128) k * n;
+      uint64_t p0 = isqrt(kn);
+      uint64_t q = (uint64_t) (kn - (unsigned __int128) p0 * p0);
+      if (q == 0)
+         continue;   // kn is a square, which tells us nothing
+
+      // forward: look for a square Q at an even step, up to a few times the expected length
+      uint64_t p = p0, pPrev = p0, qPrev = 1, r = 0;
+      uint64_t limit = 3 * 2 * isqrt(2 * isqrt(kn));
+      uint64_t i = 2;
+      for (; i < limit; i++) {
+         uint64_t b = (p0 + p) / q;
+         p = b * q - p;
+         uint64_t qNext = qPrev + b * (pPrev - p);   // pPrev - p may wrap; the sum comes out right
+         qPrev = q;
+         q = qNext;
+         pPrev = p;
+         if ((i & 1) == 0 && isSquare(q, r))
+            break;
+
+         if (++checked == cancel_check_interval) {
+            iterations_done += cancel_check_interval;
+            if (shouldStop())
+               return 0;
+            checked = 0;
+         }
+      }
+      if (i >= limit)
+         continue;
+
+      // reverse: from the square root form until P stops changing
+      uint64_t b = (p0 - p) / r;
+      p = b * r + p;
+      qPrev = r;
+      q = (uint64_t) ((kn - (unsigned __int128) p * p) / qPrev);
+      do {
+         b = (p0 + p) / q;
+         pPrev = p;
+         p = b * q - p;
+         uint64_t qNext = qPrev + b * (pPrev - p);
+         qPrev = q;
+         q = qNext;
+
+         if (++checked == cancel_check_interval) {
+            iterations_done += cancel_check_interval;
+            if (shouldStop())
+               return 0;
+            checked = 0;
+         }
+      } while (p != pPrev);
+
+      g = boost::integer::gcd(n, qPrev);
+      if (g != 1 && g != n)
+         return g;
+   }
+   return 1;
+}
+
+/**********************************************************************************************
+ * calcHartOLF - Hart's one line factoring: for i = 1, 2, ... takes s, the ceiling of
+ *               sqrt(in), and stops when s^2 mod n is a square t^2, as then gcd(s - t, n) is
+ *               nearly always a factor. n is first multiplied by 480, which makes the squares
+ *               turn up sooner. Fastest below about 42 bits and when the factors are close
+ *               together; it gives up after n^(1/3) rounds, by when it should have succeeded
+ *
+ *    Params:  n - odd composite that fits in 64 bits
+ *
+ *    Returns: a divisor if found, 1 if it gave up, 0 if stopped
+ **********************************************************************************************/
+
+uint64_t DivFinder::calcHartOLF(uint64_t n) {
+   if (n % 2 == 0)
+      return 2;
+   uint64_t root = isqrt(n);
+   if (root * root == n)
+      return root;
+
+   const unsigned __int128 multiplier = (unsigned __int128) n * 480;
+   uint64_t rounds = (uint64_t) cbrtl((long double) n) + 1;
+   unsigned int checked = 0;
+   for (uint64_t i = 1; i <= rounds; i++) {
+      unsigned __int128 in = multiplier * i;
+      uint64_t s = isqrt(in);
+      if ((unsigned __int128) s * s != in)
+         s++;
+      uint64_t m = (uint64_t) ((unsigned __int128) s * s % n);
+
+      uint64_t t;
+      if (isSquare(m, t)) {
+         uint64_t g = boost::integer::gcd(s > t ? s - t : t - s, n);
+         if (g != 1 && g != n)
+            return g;
+      }
+
+      if (++checked == cancel_check_interval) {
+         iterations_done += cancel_check_interval;
+         if (shouldStop())
+            return 0;
+         checked = 0;
+      }
+   }
+   return 1;
+}
+
+/**********************************************************************************************
+ * calcBrentRho - calcPollardsRho64 on LARGEINT arithmetic. Like calcPollardsRho it publishes
+ *                its walk for checkpoints and picks up a checkpointed walk on the same number
+ *
+ *    Params:  n - odd composite
+ *
+ *    Returns: a divisor if found, n if the walk cycled without one, 0 if stopped
+ **********************************************************************************************/
+
+LARGEINT DivFinder::calcBrentRho(LARGEINT n) {
+   if (n % 2 == 0)
+      return 2;
+
+   LARGEINT y = (rng() % (n - 2)) + 2;
+   LARGEINT c = (rng() % (n - 1)) + 1;
+
+   state_mtx.lock();
+   if (walk_n == n) {
+      y = walk_y;
+      c = walk_c;
+   }
+   state_mtx.unlock();
+
+   auto next = [&n, &c](const LARGEINT &v) { return addMod(mulMod(v, v, n), c, n); };
+   auto distance = [](const LARGEINT &a, const LARGEINT &b) { return a > b ? (LARGEINT) (a - b) : (LARGEINT) (b - a); };
+
+   LARGEINT x = y, ys = y, q = 1, g = 1;
+   unsigned int unpublished = 0;
+   for (uint64_t r = 1; g == 1; r *= 2) {
+      x = y;
+      for (uint64_t i = 1; i <= r; i++) {
+         y = next(y);
+         if (i % brent_batch == 0 && shouldStop()) {
+            finishWalk(n);
+            return 0;
+         }
+      }
+      iterations_done += r;
+      rhoIterations.add(r);
+
+      for (uint64_t k = 0; k < r && g == 1; k += brent_batch) {
+         if (shouldStop()) {
+            finishWalk(n);
+            return 0;
+         }
+         ys = y;
+         uint64_t steps = std::min((uint64_t) brent_batch, r - k);
+         for (uint64_t i = 0; i < steps; i++) {
+            y = next(y);
+            q = mulMod(q, distance(x, y), n);
+         }
+         iterations_done += steps;
+         rhoIterations.add(steps);
+         g = boost::math::gcd(q, n);
+
+         unpublished += steps;
+         if (unpublished >= walk_publish_interval) {
+            unpublished = 0;
+            std::lock_guard<std::mutex> lock(state_mtx);
+            walk_n = n;
+            walk_x = x;
+            walk_y = y;
+            walk_c = c;
+            state_version++;
+         }
+      }
+   }
+
+   if (g == n) {
+      do {
+         ys = next(ys);
+         g = boost::math::gcd(distance(x, ys), n);
+      } while (g == 1);
+   }
+
+   finishWalk(n);
+   return g;
+}
+
+/**********************************************************************************************
+ * ECM on Montgomery curves By^2 = x^3 + Ax^2 + x, using only the x coordinate in projective
+ * form (X : Z). (A + 2) / 4 is kept as the fraction a24num / a24den so no inverse is needed.
+ **********************************************************************************************/
+
+struct EcmCurve {
+   LARGEINT n, a24num, a24den;
+};
+
+struct EcmPoint {
+   LARGEINT x, z;
+};
+
+// ECM's stage 1 bound by the width of n, sized for its smallest factor (at most half of it)
+static uint64_t ecmBound(int bits) {
+   if (bits <= 66)
+      return 500;
+   if (bits <= 100)
+      return 2000;
+   return 11000;
+}
+
+static EcmPoint ecmDouble(const EcmPoint &p, const EcmCurve &curve) {
+   const LARGEINT &n = curve.n;
+   LARGEINT sum = addMod(p.x, p.z, n), diff = subMod(p.x, p.z, n);
+   LARGEINT sum2 = mulMod(sum, sum, n), diff2 = mulMod(diff, diff, n);
+   LARGEINT xz4 = subMod(sum2, diff2, n);   // 4XZ
+
+   EcmPoint result;
+   result.x = mulMod(mulMod(sum2, diff2, n), curve.a24den, n);
+   result.z = mulMod(xz4, addMod(mulMod(diff2, curve.a24den, n), mulMod(xz4, curve.a24num, n), n), n);
+   return result;
+}
+
+// p + q, given p - q
+static EcmPoint ecmAdd(const EcmPoint &p, const EcmPoint &q, const EcmPoint &diff, const LARGEINT &n) {
+   LARGEINT u = mulMod(subMod(p.x, p.z, n), addMod(q.x, q.z, n), n);
+   LARGEINT v = mulMod(addMod(p.x, p.z, n), subMod(q.x, q.z, n), n);
+   LARGEINT sum = addMod(u, v, n), dif = subMod(u, v, n);
+
+   EcmPoint result;
+   result.x = mulMod(diff.z, mulMod(sum, sum, n), n);
+   result.z = mulMod(diff.x, mulMod(dif, dif, n), n);
+   return result;
+}
+
+// k * p with the Montgomery ladder, which keeps the two points it holds exactly p apart
+static EcmPoint ecmMultiply(const EcmPoint &p, uint64_t k, const EcmCurve &curve) {
+   EcmPoint r0 = p, r1 = ecmDouble(p, curve);
+
+   uint64_t mask = 1ull << 63;
+   while ((k & mask) == 0)
+      mask >>= 1;
+   for (mask >>= 1; mask != 0; mask >>= 1) {
+      if (k & mask) {
+         r0 = ecmAdd(r1, r0, p, curve.n);
+         r1 = ecmDouble(r1, curve);
+      } else {
+         r1 = ecmAdd(r0, r1, p, curve.n);
+         r0 = ecmDouble(r0, curve);
+      }
+   }
+   return r0;
+}
+
+/**********************************************************************************************
+ * calcECM - one curve of Lenstra's elliptic curve method, stage 1 only: a random point is
+ *           multiplied by every prime power up to a bound that depends on the size of n. If
+ *           the curve's order modulo some prime factor p of n is that smooth, the point becomes
+ *           the identity modulo p and p divides its Z. Curves come from Suyama's
+ *           parametrization, which makes the order divisible by 12
+ *
+ *    Params:  n - composite with no factors of 2 or 3
+ *
+ *    Returns: a divisor if found, n if this curve didn't give one, 0 if stopped
+ **********************************************************************************************/
+
+LARGEINT DivFinder::calcECM(LARGEINT n) {
+   if (n % 2 == 0)
+      return 2;
+   if (n % 3 == 0)
+      return 3;
+
+   LARGEINT sigma = (rng() % (n - 6)) + 6;
+   LARGEINT u = subMod(mulMod(sigma, sigma, n), 5, n);
+   LARGEINT v = mulMod(4, sigma, n);
+   LARGEINT u3 = mulMod(mulMod(u, u, n), u, n);
+   LARGEINT vu = subMod(v, u, n);
+
+   EcmCurve curve;
+   curve.n = n;
+   curve.a24num = mulMod(mulMod(mulMod(vu, vu, n), vu, n), addMod(mulMod(3, u, n), v, n), n);
+   curve.a24den = mulMod(mulMod(16, u3, n), v, n);
+
+   // a denominator that isn't invertible is either a bad sigma or, with luck, a factor
+   LARGEINT g = boost::math::gcd(curve.a24den, n);
+   if (g != 1)
+      return g;
+
+   EcmPoint point;
+   point.x = u3;
+   point.z = mulMod(mulMod(v, v, n), v, n);
+
+   uint64_t bound = ecmBound((int) msb(n) + 1);
+   for (uint32_t prime : sievedPrimes()) {
+      if (prime > bound)
+         break;
+      uint64_t power = prime;
+      while (power <= bound / prime)
+         power *= prime;
+
+      point = ecmMultiply(point, power, curve);
+      for (uint64_t bits = power; bits > 1; bits >>= 1)
+         iterations_done++;
+      if (shouldStop())
+         return 0;
+   }
+
+   g = boost::math::gcd(point.z, n);
+   return g == 1 ? n : g;
+}
+
+/**********************************************************************************************
+ * Pollard's p - 1. If p - 1 divides E for some prime factor p of n, then a^E = 1 (mod p) and
+ * p divides gcd(a^E - 1, n). Stage 1 takes E as every prime power up to B1; stage 2 then
+ * allows one more prime q up to B2 by multiplying together a^(Eq) - 1 for each q, stepping
+ * from one prime to the next with a table of a^E raised to the gaps between them.
+ **********************************************************************************************/
+
+// p - 1's bounds by the width of n. Cheap enough next to the methods they run before that
+// it's worth having a go whatever the chances
+static void pm1Bounds(int bits, uint64_t &b1, uint64_t &b2) {
+   if (bits <= 64) {
+      b1 = 300;
+      b2 = 10000;
+   } else if (bits <= 100) {
+      b1 = 5000;
+      b2 = 250000;
+   } else {
+      b1 = 10000;
+      b2 = prime_table_limit;
+   }
+}
+
+template <typename T>
+static T decrementMod(const T &x, const T &n) {
+   return x == 0 ? (T) (n - 1) : (T) (x - 1);
+}
+
+template <typename T>
+T DivFinder::runPollardPM1(const T &n, uint64_t b1, uint64_t b2) {
+   const std::vector<uint32_t> &primes = sievedPrimes();
+
+   // stage 1, with a gcd every pm1_batch primes. If a batch takes every prime factor at once,
+   // it is replayed a prime at a time from where it started
+   // not 2, whose order is tiny modulo the factors of 2^k +/- 1
+   T a = 3, saved = a, g = 1;
+   size_t i = 0, batchStart = 0;
+   for (; i < primes.size() && primes[i] <= b1; i++) {
+      uint64_t power = primes[i];
+      while (power <= b1 / primes[i])
+         power *= primes[i];
+      a = powMod(a, T(power), n);
+      iterations_done += (unsigned long) msb(power) + 1;
+
+      bool last = i + 1 == primes.size() || primes[i + 1] > b1;
+      if ((i + 1 - batchStart) < pm1_batch && !last)
+         continue;
+      if (shouldStop())
+         return 0;
+
+      g = boost::integer::gcd(decrementMod(a, n), n);
+      if (g == n) {
+         a = saved;
+         for (size_t j = batchStart; j <= i; j++) {
+            power = primes[j];
+            while (power <= b1 / primes[j])
+               power *= primes[j];
+            a = powMod(a, T(power), n);
+            g = boost::integer::gcd(decrementMod(a, n), n);
+            if (g != 1)
+               break;
+         }
+      }
+      if (g != 1)
+         return g == n ? 1 : g;   // n itself: every factor's p - 1 is that smooth
+      saved = a;
+      batchStart = i + 1;
+   }
+
+   if (i == primes.size() || primes[i] > b2)
+      return 1;
+
+   // stage 2: x = a^q for each prime q in turn, with gaps[k] = a^(2k)
+   std::vector<T> gaps(1, 1);
+   T x = powMod(a, T(primes[i]), n), product = decrementMod(x, n);
+   unsigned int checked = 0;
+   for (i++; i < primes.size() && primes[i] <= b2; i++) {
+      size_t gap = (primes[i] - primes[i - 1]) / 2;
+      while (gaps.size() <= gap)
+         gaps.push_back(mulMod(gaps.back(), mulMod(a, a, n), n));
+      x = mulMod(x, gaps[gap], n);
+      product = mulMod(product, decrementMod(x, n), n);
+      iterations_done += 2;
+
+      if (++checked == pm1_batch) {
+         checked = 0;
+         if (shouldStop())
+            return 0;
+         g = boost::integer::gcd(product, n);
+         if (g != 1)
+            return g == n ? 1 : g;
+      }
+   }
+   g = boost::integer::gcd(product, n);
+   return g == n ? 1 : g;
+}
+
+/**********************************************************************************************
+ * calcPollardPM1 - Pollard's p - 1 with bounds chosen by the size of n, on native integers if
+ *                  n fits in 64 bits. It finds a factor p whatever its size if p - 1 is smooth,
+ *                  so it's a cheap first try before the methods whose cost grows with p
+ *
+ *    Params:  n - odd composite
+ *
+ *    Returns: a divisor if found, 1 if there was none to find with these bounds, 0 if stopped
+ **********************************************************************************************/
+
+LARGEINT DivFinder::calcPollardPM1(LARGEINT n) {
+   if (n % 2 == 0)
+      return 2;
+
+   uint64_t b1, b2;
+   pm1Bounds((int) msb(n) + 1, b1, b2);
+   if (n <= std::numeric_limits<uint64_t>::max())
+      return (LARGEINT) runPollardPM1((uint64_t) n, b1, b2);
+   return runPollardPM1(n, b1, b2);
+}
+
 
 void DivFinder::combinePrimes(std::list<LARGEINT> &dest) {
    dest.insert(dest.end(), primes.begin(), primes.end());
@@ -106,12 +861,110 @@ void DivFinder::combinePrimes(std::list<LARGEINT> &dest) {
 
 
 void DivFinder::clean_up(){
+   std::lock_guard<std::mutex> lock(state_mtx);
    primes.clear();
+   pending.clear();
+   walk_n = 0;
+   resumed = false;
    cancel_bool = false;
+   methods_used.clear();
+   stage_deadline_ns = 0;
+   stage_expired = false;
+   budget_deadline_ns = 0;
+   budget_iterations = 0;
+   iterations_done = 0;
+   clock_checked_at = 0;
+   budget_exhausted = false;
+}
+
+void DivFinder::setBudget(int64_t deadline_ns, unsigned long iterations) {
+   budget_deadline_ns = deadline_ns;
+   budget_iterations = iterations;
+   iterations_done = 0;
+   clock_checked_at = 0;
+   budget_exhausted = deadline_ns != 0 && steadyNs() >= deadline_ns;
+}
+
+/**********************************************************************************************
+ * getCheckpoint - copies out the primes found so far, the cofactors still to be factored and the
+ *                 current rho walk. Safe to call from another thread while factoring runs.
+ **********************************************************************************************/
+FactorCheckpoint DivFinder::getCheckpoint() {
+   std::lock_guard<std::mutex> lock(state_mtx);
+
+   FactorCheckpoint checkpoint;
+   checkpoint.primes = primes;
+   checkpoint.cofactors = pending;
+   checkpoint.walk_n = walk_n;
+   checkpoint.walk_x = walk_x;
+   checkpoint.walk_y = walk_y;
+   checkpoint.walk_c = walk_c;
+   checkpoint.version = state_version;
+   return checkpoint;
+}
+
+/**********************************************************************************************
+ * resumeFrom - loads a checkpoint taken on another slave node. Call before PolRho; it will then
+ *              only factor the checkpoint's cofactors, keeping the primes already found.
+ **********************************************************************************************/
+void DivFinder::resumeFrom(const FactorCheckpoint &checkpoint) {
+   std::lock_guard<std::mutex> lock(state_mtx);
+
+   primes = checkpoint.primes;
+   pending = checkpoint.cofactors;
+   walk_n = checkpoint.walk_n;
+   walk_x = checkpoint.walk_x;
+   walk_y = checkpoint.walk_y;
+   walk_c = checkpoint.walk_c;
+   resumed = true;
 }
 void DivFinder::cancel_op(){
    cancel_bool = true;
 }
+void DivFinder::setPolicy(const FactorPolicy *policy) {
+   this->policy = policy;
+}
+
+void DivFinder::recordMethod(FactorMethod method) {
+   divisorsFound(method).add();
+   if (std::find(methods_used.begin(), methods_used.end(), method) == methods_used.end())
+      methods_used.push_back(method);
+}
+
+void DivFinder::startStage(unsigned int timeMs) {
+   stage_deadline_ns = timeMs != 0 ? steadyNs() + (int64_t) timeMs * 1000000 : 0;
+   stage_clock_checked_at = iterations_done;
+   stage_expired = false;
+}
+
+/**********************************************************************************************
+ * shouldStop - checkBool, or the time slice of the running policy step is over. The methods'
+ *              loops call this; factorPending calls checkBool to tell the two apart
+ **********************************************************************************************/
+bool DivFinder::shouldStop() {
+   if (checkBool() || stage_expired)
+      return true;
+
+   if (stage_deadline_ns != 0 && iterations_done - stage_clock_checked_at >= budget_clock_interval) {
+      stage_clock_checked_at = iterations_done;
+      stage_expired = steadyNs() >= stage_deadline_ns;
+   }
+   return stage_expired;
+}
+
+/**********************************************************************************************
+ * checkBool - true once the job has been cancelled or has run out of budget. The clock is only
+ *             read every budget_clock_interval iterations
+ **********************************************************************************************/
 bool DivFinder::checkBool(){
-   return cancel_bool;
+   if (cancel_bool || budget_exhausted)
+      return true;
+
+   if (budget_iterations != 0 && iterations_done >= budget_iterations)
+      budget_exhausted = true;
+   else if (budget_deadline_ns != 0 && iterations_done - clock_checked_at >= budget_clock_interval) {
+      clock_checked_at = iterations_done;
+      budget_exhausted = steadyNs() >= budget_deadline_ns;
+   }
+   return budget_exhausted;
 }
@@ -1,4 +1,5 @@
 #include "DivFinderSP.h"
+#include "Trace.h"
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
@@ -25,62 +26,36 @@ DivFinderSP::~DivFinderSP() {
 /* "Signed int made of twice the bits as LARGEINT2X" */
 #define LARGESIGNED2X int512_t
 
-void DivFinderSP::PolRho(std::list<LARGEINT> &prime_factors){
-   primes.clear();
+void DivFinderSP::PolRho(FactorResult &result){
    DivFinder::setVerbose(3);
-   factor();
-   if(checkBool()){
+
+   // A resumed job already has its primes and remaining cofactors loaded
+   if (resumed)
+      factorPending();
+   else {
+      primes.clear();
+      factor();
+   }
+
+   if(cancel_bool){
       clean_up();
       return;
    }
-   combinePrimes(prime_factors);
+   combinePrimes(result.primes);
+   result.methods = methods_used;
+
+   // out of budget: whatever is still pending is handed back unfactored
+   if (budget_exhausted) {
+      std::lock_guard<std::mutex> lock(state_mtx);
+      for (auto &n : pending)
+         if (n != 1)
+            result.unfactored.push_back(n);
+   }
    clean_up();
 
    return;
 }
 
-/*******************************************************************************
- *
- * isPrimeBF - Uses a simple brute force primality test with 6k +/- 1 optimization
- *             
- *
- *    Params:  n - the number to test for prime
- *             divisor - return value of the discovered divisor if not prime
- *
- *    Returns: true if prime, false otherwise
- *
- *******************************************************************************/
-
-bool DivFinderSP::isPrimeBF(LARGEINT n, LARGEINT &divisor) {
-   if (verbose >= 3)
-      std::cout << "Checking if prime: " << n << std::endl;
-
-   divisor = 0;
-
-   // Take care of simple cases
-   if (n <= 3) {
-      return n > 1;
-   }
-   else if ((n % 2) == 0) {
-      divisor = 2;
-      return false;
-   } else if ((n & 3) == 0) {
-      divisor = 3;
-      return false;
-   }
-
-   // Assumes all primes are to either side of 6k. Using 256 bit to avoid overflow
-   // issues when calculating max range
-   LARGEINT2X n_256t = n;
-   for (LARGEINT2X k=5; k * k < n_256t; k = k+6) {
-      if ((n_256t % k == 0) || (n_256t % (k+2) == 0)) {
-         divisor = (LARGEINT) k;
-         return false;
-      }
-   }
-   return true;
-}
-
 /*******************************************************************************
  *
  * factor - Calculates a single prime of the given number and recursively calls
@@ -93,6 +68,8 @@ bool DivFinderSP::isPrimeBF(LARGEINT n, LARGEINT &divisor) {
 
 void DivFinderSP::factor() {
 
+   std::unique_lock<std::mutex> lock(state_mtx);
+
    // First, take care of the '2' factors
    LARGEINT newval = getOrigVal();
    while (newval % 2 == 0) {
@@ -108,6 +85,7 @@ void DivFinderSP::factor() {
       std::cout << "Prime Found: 3\n";
       newval = newval / 3;
    }
+   lock.unlock();
 
    // Now use Pollards Rho to figure out the rest. As it's stochastic, we don't know
    // how long it will take to find an answer. Should return the final two primes
@@ -124,64 +102,143 @@ void DivFinderSP::factor() {
  ******************************************************************************/
 
 void DivFinderSP::factor(LARGEINT n) {
+   state_mtx.lock();
+   pending.push_back(n);
+   state_version++;
+   state_mtx.unlock();
 
-   // already prime
-   if (n == 1) {
-      return;
-   }
+   factorPending();
+}
 
-   if (verbose >= 2)
-      std::cout << "Factoring: " << n << std::endl;
+/*******************************************************************************
+ *
+ * factorPending - works through the cofactors in pending until all of them are
+ *                 broken down into primes. Divisors found are pushed back onto
+ *                 pending instead of recursing, so the state of the whole job
+ *                 can be checkpointed at any time.
+ *
+ ******************************************************************************/
 
-   bool div_found = false;
-   unsigned int iters = 0;
+void DivFinderSP::factorPending() {
 
-   while (!div_found) {
+   while (true) {
       if(checkBool())
          return;
-      if (verbose >= 3)
-         std::cout << "Starting iteration: " << iters << std::endl;
 
-      // If we have tried Pollards Rho a specified number of times, run the
-      // costly prime check to see if this is a prime number. Also, increment
-      // iters after the check
-      if (iters++ == primecheck_depth) {
+      state_mtx.lock();
+      if (pending.empty()) {
+         state_mtx.unlock();
+         return;
+      }
+      LARGEINT n = pending.back();
+      state_mtx.unlock();
+
+      // already prime
+      if (n == 1) {
+         std::lock_guard<std::mutex> lock(state_mtx);
+         pending.pop_back();
+         state_version++;
+         continue;
+      }
+
+      // Primes need no search; Miller-Rabin tells them apart in a few hundred
+      // multiplications
+      if (isProbablePrime(n)) {
          if (verbose >= 2)
-	         std::cout << "Pollards rho timed out, checking if the following is prime: " << n << std::endl;
-         LARGEINT divisor;
-         if (isPrimeBF(n, divisor)) {
-	         if (verbose >= 2)
-	            std::cout << "Prime found: " << n << std::endl;
-            primes.push_back(n);
-	         return;
-	      } else {   // We found a prime divisor, save it and keep finding primes
-	         if (verbose >= 2)
-	            std::cout << "Prime found: " << divisor << std::endl;
-	         primes.push_back(divisor);
-	         return factor(n / divisor);
-	      }				
+            std::cout << "Prime found: " << n << std::endl;
+         std::lock_guard<std::mutex> lock(state_mtx);
+         pending.pop_back();
+         primes.push_back(n);
+         state_version++;
+         continue;
       }
 
-      // We try to get a divisor using Pollards Rho
-      LARGEINT d = calcPollardsRho(n);
+      if (verbose >= 2)
+         std::cout << "Factoring: " << n << std::endl;
+
+      LARGEINT d = findDivisor(n);
       if(checkBool())
          return;
-      if (d != n) {
-         if (verbose >= 1)
-            std::cout << "Divisor found: " << d << std::endl;
-
-         // Factor the divisor
-         factor(d);
 
-         // Now the remaining number
-         factor((LARGEINT) (n/d));
-         return;
-      }
+      if (verbose >= 1)
+         std::cout << "Divisor found: " << d << std::endl;
+      Trace::get().record(tr_divisor_found, -1, -1, seed);
 
-      // If d == n, then we re-randomize and continue the search up to the prime check depth
+      // Factor the divisor first, then the remaining number
+      std::lock_guard<std::mutex> lock(state_mtx);
+      pending.pop_back();
+      pending.push_back((LARGEINT) (n/d));
+      pending.push_back(d);
+      state_version++;
    }
-   throw std::runtime_error("Reached end of function--this should not have happened.");
-   return;
 }
 
+/*******************************************************************************
+ *
+ * findDivisor - works through the policy's steps for a composite of n's size
+ *               until one of them finds a divisor. A step that runs out of time
+ *               or has nothing more to offer (trial division up to its limit,
+ *               SQUFOF, Hart's method or p - 1 having run their course, a 64 bit method
+ *               on a number wider than 64 bits) hands over to the next;
+ *               the last step keeps going with new random starts, and if even
+ *               that can't go on Brent's rho takes over
+ *
+ *    Returns: a divisor of n other than 1 and n, or 0 if the job was stopped
+ *
+ ******************************************************************************/
 
+LARGEINT DivFinderSP::findDivisor(LARGEINT n) {
+   static const FactorPolicy defaultPolicy;
+   const auto &steps = (policy != nullptr ? policy : &defaultPolicy)->stepsFor((int) msb(n) + 1);
+
+   for (size_t step = 0; ; step++) {
+      bool last = step + 1 >= steps.size();
+      FactorMethod method = step < steps.size() ? steps[step].method : fm_brent;
+      startStage(last ? 0 : steps[step].timeMs);
+
+      while (true) {
+         LARGEINT d = 0;
+         switch (method) {
+         case fm_trial:
+            d = calcTrialDivision(n, trial_division_limit);
+            if (d == n)
+               d = 1;   // no divisor that small
+            break;
+         case fm_rho:
+            d = calcPollardsRho(n);
+            break;
+         case fm_rho64:
+            d = n <= std::numeric_limits<uint64_t>::max() ? (LARGEINT) calcPollardsRho64((uint64_t) n) : 1;
+            break;
+         case fm_brent:
+            d = calcBrentRho(n);
+            break;
+         case fm_squfof:
+            d = n <= std::numeric_limits<uint64_t>::max() ? (LARGEINT) calcSQUFOF((uint64_t) n) : 1;
+            break;
+         case fm_hart:
+            d = n <= std::numeric_limits<uint64_t>::max() ? (LARGEINT) calcHartOLF((uint64_t) n) : 1;
+            break;
+         case fm_pm1:
+            d = calcPollardPM1(n);
+            break;
+         default:
+            d = calcECM(n);
+            break;
+         }
+
+         if (d != 0 && d != 1 && d != n) {
+            if (verbose >= 2)
+               std::cout << FactorPolicy::methodName(method) << " split " << n << std::endl;
+            recordMethod(method);
+            return d;
+         }
+         if (checkBool())
+            return 0;
+         if (d == 0 || d == 1)
+            break;   // time slice over, or the method is done with n
+
+         // d == n: the attempt failed, so go again with a new random start
+      }
+   }
+}
@@ -0,0 +1,132 @@
+#include "FactorPolicy.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+
+static const char *methodNames[fm_count] = { "trial", "rho", "rho64", "brent", "ecm", "squfof", "hart", "pm1" };
+
+/**********************************************************************************************
+ * FactorPolicy (constructor) - the built-in table: trial division for tiny cofactors, native
+ *                              64 bit rho up to 40 bits, and above that a p - 1 pass first.
+ *                              Then up to 64 bits a quick look with rho for a small factor
+ *                              before SQUFOF, and for anything wider a short go with Brent's
+ *                              rho for small factors before ECM takes over
+ **********************************************************************************************/
+
+FactorPolicy::FactorPolicy() {
+   rows.push_back(Row{20, {{fm_trial, 0}}});
+   rows.push_back(Row{40, {{fm_rho64, 0}}});
+   rows.push_back(Row{64, {{fm_pm1, 0}, {fm_rho64, 2}, {fm_squfof, 0}, {fm_rho64, 0}}});
+   rows.push_back(Row{128, {{fm_pm1, 0}, {fm_brent, 300}, {fm_ecm, 0}}});
+}
+
+bool FactorPolicy::load(const std::string &path, std::string &error) {
+   std::ifstream file(path);
+   if (!file) {
+      error = "can't read " + path;
+      return false;
+   }
+
+   std::vector<Row> loaded;
+   std::string line;
+   int lineNumber = 0;
+   while (std::getline(file, line)) {
+      lineNumber++;
+      auto comment = line.find('#');
+      if (comment != std::string::npos)
+         line.erase(comment);
+
+      std::istringstream tokens(line);
+      std::string bits, step;
+      if (!(tokens >> bits))
+         continue;   // blank
+
+      Row row;
+      char *end;
+      long maxBits = strtol(bits.c_str(), &end, 10);
+      if (*end != '\0' || maxBits < 1 || maxBits > 4096) {
+         error = path + ":" + std::to_string(lineNumber) + ": bad bit length '" + bits + "'";
+         return false;
+      }
+      row.maxBits = (int) maxBits;
+
+      while (tokens >> step) {
+         FactorStep parsed{fm_trial, 0};
+         auto colon = step.find(':');
+         if (!parseMethod(step.substr(0, colon), parsed.method)) {
+            error = path + ":" + std::to_string(lineNumber) + ": unknown method '" + step.substr(0, colon) + "'";
+            return false;
+         }
+         if (colon != std::string::npos) {
+            long ms = strtol(step.c_str() + colon + 1, &end, 10);
+            if (*end != '\0' || colon + 1 == step.length() || ms < 0) {
+               error = path + ":" + std::to_string(lineNumber) + ": bad time in '" + step + "'";
+               return false;
+            }
+            parsed.timeMs = (unsigned int) ms;
+         }
+         row.steps.push_back(parsed);
+      }
+      if (row.steps.empty()) {
+         error = path + ":" + std::to_string(lineNumber) + ": no methods for " + bits + " bits";
+         return false;
+      }
+      loaded.push_back(row);
+   }
+
+   if (loaded.empty()) {
+      error = path + ": no rows";
+      return false;
+   }
+   std::sort(loaded.begin(), loaded.end(), [](const Row &a, const Row &b) { return a.maxBits < b.maxBits; });
+   rows = loaded;
+   return true;
+}
+
+const std::vector<FactorStep> &FactorPolicy::stepsFor(int bits) const {
+   for (auto &row : rows)
+      if (bits <= row.maxBits)
+         return row.steps;
+   return rows.back().steps;
+}
+
+std::string FactorPolicy::methods() const {
+   bool used[fm_count] = {};
+   for (auto &row : rows)
+      for (auto &step : row.steps)
+         used[step.method] = true;
+
+   std::string names;
+   for (int method = 0; method < fm_count; method++)
+      if (used[method])
+         names += (names.empty() ? "" : ",") + std::string(methodNames[method]);
+   return names;
+}
+
+std::string FactorPolicy::describe() const {
+   std::string text;
+   for (auto &row : rows) {
+      text += (text.empty() ? "" : "; ") + std::string("<=") + std::to_string(row.maxBits) + " bits:";
+      for (auto &step : row.steps) {
+         text += " " + std::string(methodNames[step.method]);
+         if (step.timeMs != 0 && &step != &row.steps.back())
+            text += ":" + std::to_string(step.timeMs) + "ms";
+      }
+   }
+   return text;
+}
+
+const char *FactorPolicy::methodName(FactorMethod method) {
+   return methodNames[method];
+}
+
+bool FactorPolicy::parseMethod(const std::string &name, FactorMethod &method) {
+   for (int i = 0; i < fm_count; i++) {
+      if (name == methodNames[i]) {
+         method = (FactorMethod) i;
+         return true;
+      }
+   }
+   return false;
+}
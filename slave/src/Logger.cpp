@@ -1,60 +1,58 @@
 #include "Logger.h"
 #include <iostream>
-#include <fstream>
-#include "FileDesc.h"
 #include <chrono>
 #include <ctime>
-#include <sstream>
-#include <iomanip>
-#include <stdio.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 
-Logger::Logger() {
+Logger::Logger() : slots(new Slot[queueSize]) {
+	for (size_t i = 0; i < queueSize; i++)
+		slots[i].seq.store(i, std::memory_order_relaxed);
+
+	writer = std::thread(&Logger::writerThread, this);
 }
 
+/*
+ * Stops the writer thread once everything already logged has been written, then closes the
+ * log file.
+ */
 Logger::~Logger() {
+	running = false;
+	writer.join();
+
+	if (logFd != -1)
+		close(logFd);
 }
 
-bool Logger::checkForLogFile() {
-	std::ifstream f(logFileName.c_str());
-	return f.good();
+/*
+ * Sets the file to log to. The writer thread switches to it before writing its next batch.
+ */
+void Logger::setLogFileName(std::string fileName) {
+	std::lock_guard<std::mutex> lock(fileNameMutex);
+	logFileName = fileName;
+	reopen = true;
 }
 
 /*
  * Writes a message to the log file.
- * If the log file doesn't exist, this function creates the log file.
- *
- * Otherwise, if this log file exists, this function appends the message
- * to the log file. 
+ * If the log file doesn't exist, it's created when the first message is written.
  *
- * Note! This function is NOT thread safe. Ensure to use a mutex before calling
- * if running in a multi-threaded environment.
+ * The message is timestamped here and queued; it reaches the file a few milliseconds later.
+ * Only waits if the writer has fallen a full queue behind.
  */
 void Logger::log(const char *msg) {
-	FileFD logFileObj(logFileName.c_str());
-
-	// check if log file exists
-	if (!checkForLogFile())
-		std::ofstream file(logFileName.c_str());
-
-	if (!logFileObj.openFile(FileFD::appendfd))
-		throw std::runtime_error("Failed to open log file for appending!");
-
 	// make a datetime string to append to each log message
-	auto now = std::chrono::system_clock::now();
-	auto timeT = std::chrono::system_clock::to_time_t(now);
-	std::stringstream ss;
-	ss << std::put_time(std::localtime(&timeT), "%Y-%m-%d %X");
-	std::string timeStr = ss.str();
+	auto timeT = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	struct tm tmBuf;
+	char timeStr[32];
+	strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %X", localtime_r(&timeT, &tmBuf));
 
-	std::string msgString = timeStr + " : " + msg + "\n";
+	std::string line = std::string(timeStr) + " : " + msg + "\n";
 
-	auto ret = logFileObj.writeFD(msgString);
-	
-	// write returns -1 if write failed
-	if (ret == -1)
-		throw std::runtime_error("Failed to write to log file!");
-
-	logFileObj.closeFD();
+	while (!enqueue(line))
+		std::this_thread::yield();
 }
 
 /*
@@ -64,4 +62,112 @@ void Logger::log(std::string msg) {
 	log(msg.c_str());
 }
 
+/*
+ * Puts a line on the queue. Any number of threads may call this at once: each claims a slot by
+ * advancing enqueuePos, fills it, then publishes it to the writer through the slot's seq.
+ *
+ * Returns false if the queue is full.
+ */
+bool Logger::enqueue(std::string& line) {
+	size_t pos = enqueuePos.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &slots[pos & (queueSize - 1)];
+		size_t seq = slot->seq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+		if (diff == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->line = std::move(line);
+	slot->seq.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+/*
+ * Takes the oldest line off the queue. Only called by the writer thread.
+ *
+ * Returns false if the queue is empty.
+ */
+bool Logger::dequeue(std::string& line) {
+	Slot* slot = &slots[dequeuePos & (queueSize - 1)];
+	if (slot->seq.load(std::memory_order_acquire) != dequeuePos + 1)
+		return false;
+
+	line = std::move(slot->line);
+	slot->line.clear();
+	slot->seq.store(dequeuePos + queueSize, std::memory_order_release);
+	dequeuePos++;
+	return true;
+}
+
+/*
+ * Writer thread: gathers whatever is queued into one buffer and writes it, sleeping briefly when
+ * the queue is empty. Drains the queue before exiting.
+ */
+void Logger::writerThread() {
+	std::string batch, line;
+	while (true) {
+		bool stopping = !running;
+
+		batch.clear();
+		for (size_t lines = 0; lines < maxBatchLines && dequeue(line); lines++)
+			batch += line;
 
+		if (!batch.empty()) {
+			if (reopen)
+				openLogFile();
+			writeAll(batch);
+		} else if (stopping) {
+			break;
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(idleSleepMs));
+		}
+	}
+}
+
+/*
+ * (Re)opens the log file for appending, creating it if it doesn't exist.
+ */
+void Logger::openLogFile() {
+	std::string fileName;
+	{
+		std::lock_guard<std::mutex> lock(fileNameMutex);
+		fileName = logFileName;
+		reopen = false;
+	}
+
+	if (logFd != -1)
+		close(logFd);
+
+	logFd = open(fileName.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (logFd == -1)
+		std::cerr << "Failed to open log file " << fileName << ": " << strerror(errno) << "\n";
+}
+
+/*
+ * Writes data to the log file, continuing after partial writes. Lines that can't be written are
+ * dropped; the writer thread has no one to report failure to.
+ */
+void Logger::writeAll(const std::string& data) {
+	if (logFd == -1)
+		return;
+
+	size_t written = 0;
+	while (written < data.length()) {
+		ssize_t n = write(logFd, data.c_str() + written, data.length() - written);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			std::cerr << "Failed to write to log file!\n";
+			return;
+		}
+		written += n;
+	}
+}
@@ -0,0 +1,209 @@
+#include "Metrics.h"
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+/*
+ * Buckets 0-15 hold their own value. Above that, a value with its top bit at position e lands in
+ * one of the 8 buckets for [2^e, 2^(e+1)), picked by the 3 bits below the top one.
+ */
+int Histogram::bucketOf(uint64_t value) {
+	if (value < linearBuckets)
+		return (int) value;
+	int e = 63 - __builtin_clzll(value);
+	int sub = (int) ((value >> (e - 3)) & (subBuckets - 1));
+	return linearBuckets + (e - 4) * subBuckets + sub;
+}
+
+/*
+ * The largest value that lands in a bucket.
+ */
+uint64_t Histogram::bucketTop(int bucket) {
+	if (bucket < linearBuckets)
+		return bucket;
+	int e = (bucket - linearBuckets) / subBuckets + 4;
+	uint64_t sub = (bucket - linearBuckets) % subBuckets;
+	return ((subBuckets + sub + 1) << (e - 3)) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+	buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+	samples.fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t seen = largest.load(std::memory_order_relaxed);
+	while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+		;
+}
+
+/*
+ * The value below which a fraction p (0-1) of the samples fall, rounded up to the top of its
+ * bucket. 0 if nothing was recorded.
+ */
+uint64_t Histogram::percentile(double p) {
+	uint64_t n = count();
+	if (n == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (p * n);
+	if (rank >= n)
+		rank = n - 1;
+
+	uint64_t seen = 0;
+	for (int bucket = 0; bucket < numBuckets; bucket++) {
+		seen += buckets[bucket].load(std::memory_order_relaxed);
+		if (seen > rank)
+			return std::min(bucketTop(bucket), max());
+	}
+	return max();
+}
+
+/*
+ * The one registry for this process.
+ */
+Metrics& Metrics::get() {
+	static Metrics metrics;
+	return metrics;
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	auto& entry = counters[name];
+	if (!entry.second)
+		entry = std::make_pair(help, std::unique_ptr<Counter>(new Counter()));
+	return *entry.second;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	auto& entry = histograms[name];
+	if (!entry.second)
+		entry = std::make_pair(help, std::unique_ptr<Histogram>(new Histogram()));
+	return *entry.second;
+}
+
+/*
+ * Adds a function that appends lines for values computed when the metrics are rendered.
+ */
+void Metrics::addCollector(std::function<void(std::string&)> collector) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	collectors.push_back(collector);
+}
+
+void Metrics::appendHelp(std::string& out, const std::string& name, const std::string& help) {
+	out += "# HELP " + name + " " + help + "\n";
+}
+
+void Metrics::appendLine(std::string& out, const std::string& name, double value) {
+	std::ostringstream ss;
+	ss.precision(15); // whole counts print in full, not in exponent form
+	ss << name << " " << value << "\n";
+	out += ss.str();
+}
+
+/*
+ * Every metric as text: counters, then histograms (count, sum, max and p50/p90/p99/p999), then
+ * whatever the collectors add.
+ */
+std::string Metrics::render() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	std::string out;
+
+	for (auto& entry : counters) {
+		appendHelp(out, entry.first, entry.second.first);
+		appendLine(out, entry.first, entry.second.second->value());
+	}
+
+	for (auto& entry : histograms) {
+		auto& name = entry.first;
+		auto& hist = *entry.second.second;
+		appendHelp(out, name, entry.second.first);
+		appendLine(out, name + "_count", hist.count());
+		appendLine(out, name + "_sum", hist.sum());
+		appendLine(out, name + "_max", hist.max());
+		for (const char* quantile : {"0.5", "0.9", "0.99", "0.999"})
+			appendLine(out, name + "{quantile=\"" + quantile + "\"}", hist.percentile(atof(quantile)));
+	}
+
+	for (auto& collector : collectors)
+		collector(out);
+
+	return out;
+}
+
+/*
+ * Starts answering HTTP requests on ipAddr:port with the rendered metrics, on a thread of its
+ * own. Any path is answered the same way.
+ *
+ * Returns: false if the port can't be bound
+ */
+bool Metrics::serve(const char* ipAddr, unsigned short port) {
+	int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenFd == -1)
+		return false;
+
+	int on = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, ipAddr, &addr.sin_addr.s_addr);
+
+	if (bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0) {
+		std::cerr << "Failed to start metrics endpoint on " << ipAddr << ":" << port << ": " << strerror(errno) << "\n";
+		close(listenFd);
+		return false;
+	}
+
+	std::thread(&Metrics::serveThread, this, listenFd).detach();
+	return true;
+}
+
+void Metrics::serveThread(int listenFd) {
+	while (true) {
+		int conn = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+
+		// read the request head, but don't let a silent client hold up the endpoint
+		struct timeval timeout = {1, 0};
+		setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		std::string request;
+		char buf[1024];
+		while (request.find("\r\n\r\n") == std::string::npos && request.length() < 8192) {
+			ssize_t n = read(conn, buf, sizeof(buf));
+			if (n <= 0)
+				break;
+			request.append(buf, n);
+		}
+
+		std::string body = render();
+		std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+			+ std::to_string(body.length()) + "\r\nConnection: close\r\n\r\n" + body;
+
+		size_t sent = 0;
+		while (sent < response.length()) {
+			ssize_t n = send(conn, response.c_str() + sent, response.length() - sent, MSG_NOSIGNAL);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			sent += n;
+		}
+		close(conn);
+	}
+}
@@ -4,11 +4,23 @@
 #include <regex>
 #include "exceptions.h"
 #include "DivFinderSP.h"
+#include "Trace.h"
+#include "Metrics.h"
+#include "Decimal.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/numeric/conversion/cast.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
 
 
+static Counter &rhoIterations = Metrics::get().counter("slave_rho_iterations_total", "Pollard's rho iterations run");
+
+static int64_t steadyNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 /**********************************************************************************************
  * TCPClient (constructor) - Creates a Stdin file descriptor to simplify handling of user input. 
  *
@@ -86,10 +98,15 @@ void TCPClient::connectTo(const char *ip_addr, unsigned short port) {
 
 void TCPClient::handleConnection() {
 
+	std::unique_lock<std::mutex> lock(this->mtx1);
 	while (!connClosed && !connectionBroke) {
-		// check if we got any new messages from the server
-		this->mtx1.lock();
-		if(!this->receivedMessages.empty()) {
+		// sleep until the server sends something or it's time to give up on its heartbeat
+		this->wakeup.wait_for(lock, heartbeatWait(), [this] {
+			return !this->receivedMessages.empty() || connClosed || connectionBroke;
+		});
+		if (heartbeatExpired())
+			this->connectionBroke = true;
+		while(!this->receivedMessages.empty()) {
 			auto message = this->receivedMessages.front();
 			
 			if (sanitizeUserInput(message).compare("") != 0) // only display messages that have data
@@ -97,71 +114,159 @@ void TCPClient::handleConnection() {
 
 			this->receivedMessages.pop();
 		}
-		this->mtx1.unlock();
 	}
+	lock.unlock();
 
 	// check for broken connection
 	if (this->connectionBroke) 
-		throw std::runtime_error("Failed to receive heartbeat from server for 8 seconds!");
+		throw std::runtime_error("Lost connection with server, or failed to receive heartbeat from server for " + std::to_string(heartbeatTimeoutMs) + "ms!");
 }
 
+/**********************************************************************************************
+ * sendData - sends a message (or several, newline separated) to the server, newline terminated
+ *            so the server can tell where it ends if several messages arrive in the same read.
+ *            Only the sending thread writes to the socket.
+ **********************************************************************************************/
 bool TCPClient::sendData(std::string data) {
-	if (send(this->sockfd, data.c_str(), data.length(), 0) < 0) {
-		std::cout << "Failed to send.\n";
-		return false;
+	data += "\n";
+	size_t sent = 0;
+	while (sent < data.length()) {
+		auto amt_sent = send(this->sockfd, data.c_str() + sent, data.length() - sent, MSG_NOSIGNAL);
+		if (amt_sent < 0 && errno == EINTR)
+			continue;
+		if (amt_sent < 0) {
+			std::cout << "Failed to send.\n";
+			return false;
+		}
+		sent += amt_sent;
 	}
 	return true;
 }
 
-std::string TCPClient::receiveData() {
-	char buffer[2048] = "";
+/**********************************************************************************************
+ * queueMessage - queues a message for the server and wakes the sending thread to send it
+ **********************************************************************************************/
+void TCPClient::queueMessage(const std::string &message) {
+	this->mtx_send.lock();
+	sendMessages.push(message);
+	this->mtx_send.unlock();
+	this->sendReady.notify_one();
+}
+
+/**********************************************************************************************
+ * receiveData - reads whatever the server has sent us into buf
+ *
+ *    Returns: number of bytes read, 0 if the server closed the connection, -1 on error
+ **********************************************************************************************/
+ssize_t TCPClient::receiveData(std::string &buf) {
+	char buffer[2048];
 
-	if (recv(sockfd, buffer, sizeof(buffer), 0) < 0) {
+	auto amt_read = recv(sockfd, buffer, sizeof(buffer), 0);
+	if (amt_read < 0) {
 		std::cout << "Failed to receive.\n";
+		return amt_read;
 	}
 
-	std::string response(buffer);
-
-	return response;
+	buf.assign(buffer, amt_read);
+	return amt_read;
 }
 
+/**********************************************************************************************
+ * receivingThread - splits data from the server into newline terminated messages and queues
+ *                   them for handleConnection. Heartbeats are answered right here by queueing
+ *                   a HEARTBEAT_RESP echoing the server's timestamp, so the server's round trip
+ *                   measurement isn't held up by whatever the main loop is doing.
+ **********************************************************************************************/
 void TCPClient::receivingThread() {
 	while (!connClosed && !connectionBroke) {
-		auto response = receiveData();
-
-		// check for heartbeat from server
-		
-		/*
-		std::chrono::system_clock::time_point now = std::chrono::system_clock::now(); // get current time
-		if (response.compare("HEARTBEAT\n") == 0) {
-			this->lastTimeHeartBeatReceived = now;
-			continue; // don't push HB's to end user
-		} else { // check if it has been > 8 seconds since last hb
-			if (now - this->lastTimeHeartBeatReceived > std::chrono::seconds(8))
-				this->connectionBroke = true; // signal we have a broken connection
+		std::string response;
+		if (receiveData(response) <= 0) {
+			this->mtx1.lock();
+			this->connectionBroke = true; // server went away
+			this->mtx1.unlock();
+			this->wakeup.notify_all();
+			this->sendReady.notify_all();
+			break;
 		}
-		*/
 
-		this->mtx1.lock();
-		this->receivedMessages.push(response);
-		this->mtx1.unlock();
+		pendingReceived += response;
+
+		std::string::size_type newlinePos;
+		while ((newlinePos = pendingReceived.find('\n')) != std::string::npos) {
+			auto message = pendingReceived.substr(0, newlinePos);
+			pendingReceived.erase(0, newlinePos + 1);
+
+			// check for heartbeat from server
+			if (message.compare(0, 10, "HEARTBEAT|") == 0) {
+				this->mtx1.lock();
+				this->lastTimeHeartBeatReceived = std::chrono::system_clock::now();
+				this->heartBeatSeen = true;
+				this->mtx1.unlock();
+
+				queueMessage("HEARTBEAT_RESP|" + message.substr(10));
+				continue; // don't push HB's to end user
+			}
+
+			this->mtx1.lock();
+			this->receivedMessages.push(message);
+			this->mtx1.unlock();
+			this->wakeup.notify_all();
+		}
 	}
 }
 
-void TCPClient::sendingThread() {
-	while (!connClosed && !connectionBroke) {
-		std::string clientMessage;
+/**********************************************************************************************
+ * setHeartbeatTimeout - how long we wait for a heartbeat from the server before deciding the
+ *                       connection is broken
+ **********************************************************************************************/
+void TCPClient::setHeartbeatTimeout(int timeoutMs) {
+	heartbeatTimeoutMs = timeoutMs;
+}
 
-		//maybe not necessary to lock for the whole sendData() function.
-		this->mtx_send.lock();
-		if(!this->sendMessages.empty()){
-			clientMessage = sendMessages.front();
-			auto sending = sendData(clientMessage);
-			sendMessages.pop();
+/**********************************************************************************************
+ * heartbeatExpired - true if the server has been sending heartbeats but we haven't had one in
+ *                    heartbeatTimeoutMs. Call with mtx1 held.
+ **********************************************************************************************/
+bool TCPClient::heartbeatExpired() {
+	if (!heartBeatSeen)
+		return false;
+	return std::chrono::system_clock::now() - lastTimeHeartBeatReceived > std::chrono::milliseconds(heartbeatTimeoutMs);
+}
 
+/**********************************************************************************************
+ * heartbeatWait - how long the main loop can sleep before the heartbeat could expire (a minute
+ *                 if the server doesn't send heartbeats). Call with mtx1 held.
+ **********************************************************************************************/
+std::chrono::milliseconds TCPClient::heartbeatWait() {
+	if (!heartBeatSeen)
+		return std::chrono::milliseconds(60000);
+	auto left = std::chrono::duration_cast<std::chrono::milliseconds>(lastTimeHeartBeatReceived + std::chrono::milliseconds(heartbeatTimeoutMs) - std::chrono::system_clock::now());
+	return std::max(left, std::chrono::milliseconds(0)) + std::chrono::milliseconds(1);
+}
+
+/**********************************************************************************************
+ * sendingThread - sleeps until messages are queued, then sends everything queued so far in a
+ *                 single write
+ **********************************************************************************************/
+void TCPClient::sendingThread() {
+	std::unique_lock<std::mutex> lock(this->mtx_send);
+	while (!connClosed && !connectionBroke) {
+		this->sendReady.wait(lock, [this] {
+			return !this->sendMessages.empty() || connClosed || connectionBroke;
+		});
+		if (this->sendMessages.empty())
+			break;
+
+		std::string batch;
+		while (!this->sendMessages.empty()) {
+			batch += (batch.empty() ? "" : "\n") + this->sendMessages.front();
+			this->sendMessages.pop();
 		}
-		this->mtx_send.unlock();
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		// send without holding the lock, so results can be queued meanwhile
+		lock.unlock();
+		sendData(batch);
+		lock.lock();
 	}
 }
 
@@ -184,54 +289,70 @@ void TCPClient::closeConn() {
 	close(sockfd);
 }
 
+// How many jobs we run at once: one per core
+static unsigned int coreCount() {
+	unsigned int cores = std::thread::hardware_concurrency();
+	return cores == 0 ? 1 : cores;
+}
+
+/**********************************************************************************************
+ * Slave (constructor) - starts a factoring worker per job we run at once (maxJobs, or one per
+ *                       core if 0), factoring by the given policy. Their results are queued for
+ *                       the coordinator straight from the worker's thread
+ **********************************************************************************************/
+Slave::Slave(unsigned int maxJobs, const FactorPolicy &policy):TCPClient(),
+	pool(maxJobs != 0 ? maxJobs : coreCount(), policy, [this](const FactorJob &job, FactorResult &result, bool cancelled) { jobDone(job, result, cancelled); }) {
+}
+
+/**********************************************************************************************
+ * handleConnection - sleeps until a message arrives or a checkpoint or the heartbeat falls
+ *                    due, then handles whichever it was. Jobs run on the worker pool.
+ *
+ *    Throws: runtime_error if the connection to the coordinator is lost
+ **********************************************************************************************/
 void Slave::handleConnection() {
 
 	while (!connClosed && !connectionBroke) {
-		// check if we got any new messages from the server
-		this->mtx1.lock();
-		if(!this->receivedMessages.empty()) {
-			auto message = this->receivedMessages.front();
-			
-			if (sanitizeUserInput(message).compare("") != 0) // only display messages that have data
-				std::cout << "received: " << message << std::endl;
-			
-			Slave::handleMessage(sanitizeUserInput(message));
-			this->receivedMessages.pop();
+		this->jobs_mtx.lock();
+		bool haveJobs = !running_jobs.empty();
+		this->jobs_mtx.unlock();
+
+		std::unique_lock<std::mutex> lock(this->mtx1);
+		auto wait = heartbeatWait();
+		if (haveJobs) {
+			auto untilCheckpoint = std::chrono::duration_cast<std::chrono::milliseconds>(last_checkpoint + std::chrono::milliseconds(checkpoint_interval_ms) - std::chrono::steady_clock::now());
+			wait = std::min(wait, std::max(untilCheckpoint, std::chrono::milliseconds(0)) + std::chrono::milliseconds(1));
 		}
-		this->mtx1.unlock();
-		if(cancel_op){
-			prime_factors.clear();
-			cancel_op = false;
-			if(slave_div != nullptr){
-				slave_div->cancel_op();
-				div_thread.join();
-				delete slave_div;
-				slave_div = nullptr;
-			}
+		this->wakeup.wait_for(lock, wait, [this] {
+			return !this->receivedMessages.empty() || connClosed || connectionBroke;
+		});
+		if (heartbeatExpired())
+			this->connectionBroke = true;
+
+		bool haveMessage = !this->receivedMessages.empty();
+		std::string message;
+		if (haveMessage) {
+			message = this->receivedMessages.front();
+			this->receivedMessages.pop();
 		}
-		if(!prime_factors.empty()){
-/* 			std::cout << "Prime factors are: ";
-			for(std::list<LARGEINT>::const_iterator itr = prime_factors.begin(), end = prime_factors.end(); itr != end; itr++) {
-				//std::cout << *itr << " ";
-				std::cout << "Testing... " + LARGEtostr(*itr) + ",";
-			} 
-			std::cout << std::endl; */
-			std::string pollardResponse = "POLLARD_RESP|" + std::to_string(client_ID) + "|" + std::to_string(slave_ID) + "|" + LARGEtostr(num_to_factor) + "|";
-			for(std::list<LARGEINT>::const_iterator itr = prime_factors.begin(), end = prime_factors.end(); itr != end; itr++) {
-				pollardResponse = pollardResponse + LARGEtostr(*itr) + ",";
+		lock.unlock();
+
+		if (haveMessage) {
+			if (sanitizeUserInput(message).compare("") != 0) // only display messages that have data
+				std::cout << "received: " << message << std::endl;
+			try {
+				Slave::handleMessage(sanitizeUserInput(message));
+			} catch (std::logic_error &e) { // out_of_range and invalid_argument from a malformed message
+				std::cout << "ignoring malformed message: " << e.what() << std::endl;
 			}
-			this->mtx_send.lock();
-			sendMessages.push(pollardResponse.substr(0,pollardResponse.size()-1));
-			this->mtx_send.unlock();
-			prime_factors.clear();
-			div_thread.join();
-			delete slave_div;
-			slave_div = nullptr;
 		}
+
+		if (haveJobs && std::chrono::steady_clock::now() - last_checkpoint > std::chrono::milliseconds(checkpoint_interval_ms))
+			sendCheckpoints();
 	}
 	// check for broken connection
 	if (this->connectionBroke) 
-		throw std::runtime_error("Failed to receive heartbeat from server for 8 seconds!");
+		throw std::runtime_error("Lost connection with server, or failed to receive heartbeat from server for " + std::to_string(heartbeatTimeoutMs) + "ms!");
 }
 
 void Slave::handleMessage(std::string msg) {
@@ -239,34 +360,265 @@ void Slave::handleMessage(std::string msg) {
 	boost::algorithm::split(splitMessage, msg, boost::is_any_of("|"));
  	auto messageType = splitMessage.at(0);
 	if(messageType.compare("POLLARD_REQ") == 0) {
-		//REQ|SlaveID|ClientID|Number
-		client_ID = stoi(splitMessage.at(1));
-		slave_ID = stoi(splitMessage.at(2));
-		num_to_factor = strtoLARGE(splitMessage.at(3));
-		cancel_op = false;
-		//run pollards RHO
-		slave_div = new DivFinderSP(num_to_factor);
-		div_thread = std::thread(&DivFinderSP::PolRho, slave_div, std::ref(prime_factors));
+		//REQ|SlaveID|ClientID|Number|Seed|JobID|BudgetMs|BudgetIterations[|Primes|Cofactors|Walk]
+		FactorJob job;
+		job.slaveId = stoi(splitMessage.at(1));
+		job.clientId = stoi(splitMessage.at(2));
+		job.seed = std::stoul(splitMessage.at(4));
+		job.id = std::stoul(splitMessage.at(5));
+		job.budgetMs = std::stoul(splitMessage.at(6));
+		job.budgetIterations = std::stoul(splitMessage.at(7));
+		try {
+			job.number = strtoLARGE(splitMessage.at(3));
+		} catch (std::logic_error &e) { // too wide for a LARGEINT: tell the coordinator rather than leave it waiting
+			//ERR|SlaveID|ClientID|Number|JobID|Error
+			queueMessage("POLLARD_ERR|" + splitMessage.at(1) + "|" + splitMessage.at(2) + "|" + splitMessage.at(3) + "|" + splitMessage.at(5) + "|" + e.what());
+			return;
+		}
+		if (splitMessage.size() > 10) { // another slave node got part way through this job
+			job.resume = true;
+			job.checkpoint = parseCheckpointFields(splitMessage.at(8), splitMessage.at(9), splitMessage.at(10));
+		}
+		Trace::get().record(tr_slave_start, job.clientId, -1, job.seed, job.slaveId);
+
+		this->jobs_mtx.lock();
+		if (running_jobs.empty())
+			last_checkpoint = std::chrono::steady_clock::now();
+		running_jobs[job.id].job = job;
+		running_jobs[job.id].job.checkpoint = FactorCheckpoint(); // not needed after it's loaded
+		this->jobs_mtx.unlock();
+
+		//run pollards RHO on the next free worker
+		pool.submit(job);
 
 	} else if (messageType.compare("CANCEL_REQ") == 0) {
-		//cancel and send CANCEL_RESP to coordinator
-		cancel_op = true;
-		slave_ID = stoi(splitMessage.at(1));
-		mtx_send.lock();
-		sendMessages.push("CANCEL_RESP|" + std::to_string(slave_ID));
-		mtx_send.unlock();
+		//REQ|SlaveID|JobID: cancel and send CANCEL_RESP to coordinator
+		auto slaveId = splitMessage.at(1);
+		auto jobId = splitMessage.at(2);
+		pool.cancel(std::stoul(jobId));
+		queueMessage("CANCEL_RESP|" + slaveId + "|" + jobId);
 	}
 }
 
+/**********************************************************************************************
+ * jobDone - called by the worker pool when a job ends. Queues the POLLARD_RESP unless the job
+ *           was cancelled. The methods that split the number are listed so the coordinator can
+ *           see which ones pay off; a job that ran out of budget adds the cofactors it didn't
+ *           factor
+ **********************************************************************************************/
+void Slave::jobDone(const FactorJob &job, FactorResult &result, bool cancelled) {
+	this->jobs_mtx.lock();
+	running_jobs.erase(job.id);
+	this->jobs_mtx.unlock();
+	if (cancelled)
+		return;
+
+	std::string pollardResponse = "POLLARD_RESP|" + std::to_string(job.slaveId) + "|" + std::to_string(job.clientId) + "|" + LARGEtostr(job.number) + "|";
+	for(std::list<LARGEINT>::const_iterator itr = result.primes.begin(), end = result.primes.end(); itr != end; itr++) {
+		pollardResponse = pollardResponse + LARGEtostr(*itr) + ",";
+	}
+	if (!result.primes.empty())
+		pollardResponse.pop_back();
+	pollardResponse += "|" + std::to_string(job.id) + "|";
+
+	for (auto method : result.methods)
+		pollardResponse += std::string(FactorPolicy::methodName(method)) + ",";
+	if (!result.methods.empty())
+		pollardResponse.pop_back();
+
+	// RESP|SlaveID|ClientID|Number|Primes|JobID|Methods[|Unfactored]
+	if (!result.unfactored.empty()) {
+		pollardResponse += "|";
+		for (auto &cofactor : result.unfactored)
+			pollardResponse += LARGEtostr(cofactor) + ",";
+		pollardResponse.pop_back();
+	}
+	Trace::get().record(tr_slave_done, job.clientId, -1, job.seed, job.slaveId);
+	queueMessage(pollardResponse);
+}
+
+/**********************************************************************************************
+ * strtoLARGE - reads a decimal number from a message
+ *
+ *    Throws: invalid_argument if it isn't a number, out_of_range if it doesn't fit in a LARGEINT
+ **********************************************************************************************/
 LARGEINT Slave::strtoLARGE(std::string str_num) {
-	LARGEINT res = 0;
-	for ( size_t i = 0; i < str_num.length(); i++){
-		res = res*10 + (str_num.at(i) - '0');
+	LARGEINT res;
+	if (!parseDecimal(str_num, res)) {
+		if (isDecimal(str_num))
+			throw std::out_of_range("number too large for LARGEINT: " + str_num);
+		throw std::invalid_argument("not a number: " + str_num);
 	}
 	return res;
 }
 std::string Slave::LARGEtostr(LARGEINT i) {
-	std::stringstream ss;
-	ss << i;
-	return ss.str();
-}
\ No newline at end of file
+	return formatDecimal(i);
+}
+
+/**********************************************************************************************
+ * connectTo - connects to the coordinator like any other client, then queues a REGISTER
+ *             message announcing what this slave node is capable of so the coordinator can
+ *             place work on it according to its hardware.
+ *
+ *    Throws: socket_error exception if failed. socket_error is a child class of runtime_error
+ **********************************************************************************************/
+void Slave::connectTo(const char *ip_addr, unsigned short port) {
+	TCPClient::connectTo(ip_addr, port);
+
+	auto registerMessage = buildRegisterMessage();
+	std::cout << "sending: " << registerMessage << std::endl;
+
+	queueMessage(registerMessage);
+}
+
+/**********************************************************************************************
+ * buildRegisterMessage - builds the capability announcement for this slave node. Format is
+ *                        REGISTER|cores|width1,width2,...|algorithm1,algorithm2,...|benchmarkScore
+ *
+ *    Returns: the REGISTER message
+ **********************************************************************************************/
+std::string Slave::buildRegisterMessage() {
+	unsigned int cores = pool.size(); // the coordinator sends us up to this many jobs at once
+
+	// widths we can hold a number to factor in; LARGEINT is set up in configure.ac
+	std::string widths = "64," + std::to_string(std::numeric_limits<LARGEINT>::digits);
+
+	// the methods our factoring policy uses
+	std::string algorithms = pool.getPolicy().methods();
+
+	std::stringstream score;
+	score << std::fixed << std::setprecision(2) << runBenchmark();
+
+	return "REGISTER|" + std::to_string(cores) + "|" + widths + "|" + algorithms + "|" + score.str();
+}
+
+/**********************************************************************************************
+ * runBenchmark - times the modular squaring step Pollards Rho spends nearly all of its time
+ *                in, using the same LARGEINT2X arithmetic the factoring code uses.
+ *
+ *    Returns: number of modular squarings per millisecond (higher is faster)
+ **********************************************************************************************/
+double Slave::runBenchmark() {
+	const unsigned int iterations = 20000;
+
+	// a 127-bit modulus so we exercise the full width of LARGEINT
+	LARGEINT2X modulus = (LARGEINT2X(1) << 127) - 1;
+	LARGEINT2X x = 2;
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < iterations; i++)
+		x = (x * x + 1) % modulus;
+	auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// keep the compiler from optimizing the loop away: the result is stored to a volatile and read
+	// back into the score (adding nothing to it)
+	volatile uint64_t sink = (uint64_t) x;
+
+	if (elapsed <= 0)
+		elapsed = 1;
+	return iterations / elapsed + (sink & 0);
+}
+
+/**********************************************************************************************
+ * sendCheckpoints - reports how far each running job has got, if it has moved on since its last
+ *                   checkpoint. Format is
+ *                   CHECKPOINT|SlaveID|ClientID|Number|prime1,...,primeN|cofactor1,...,cofactorN|n:x:y:c|JobID
+ *                   where the walk field is the rho walk in progress (empty if none)
+ **********************************************************************************************/
+void Slave::sendCheckpoints() {
+	last_checkpoint = std::chrono::steady_clock::now();
+
+	std::vector<std::string> checkpointMessages;
+	this->jobs_mtx.lock();
+	for (auto &entry : running_jobs) {
+		auto &running = entry.second;
+		FactorCheckpoint checkpoint;
+		if (!pool.getCheckpoint(entry.first, checkpoint))
+			continue; // not started yet, or just finished
+		if (checkpoint.version == running.checkpointVersion)
+			continue;
+		running.checkpointVersion = checkpoint.version;
+
+		checkpointMessages.push_back("CHECKPOINT|" + std::to_string(running.job.slaveId) + "|" + std::to_string(running.job.clientId) + "|" + LARGEtostr(running.job.number) + "|" + buildCheckpointFields(checkpoint) + "|" + std::to_string(entry.first));
+	}
+	this->jobs_mtx.unlock();
+
+	for (auto &checkpointMessage : checkpointMessages)
+		queueMessage(checkpointMessage);
+}
+
+/**********************************************************************************************
+ * buildCheckpointFields - formats a checkpoint as primes|cofactors|walk, the same fields the
+ *                         coordinator hands back in a POLLARD_REQ to resume the job
+ **********************************************************************************************/
+std::string Slave::buildCheckpointFields(const FactorCheckpoint &checkpoint) {
+	std::string primes, cofactors, walk;
+
+	for (auto &prime : checkpoint.primes)
+		primes += (primes.empty() ? "" : ",") + LARGEtostr(prime);
+	for (auto &cofactor : checkpoint.cofactors)
+		cofactors += (cofactors.empty() ? "" : ",") + LARGEtostr(cofactor);
+	if (checkpoint.walk_n != 0)
+		walk = LARGEtostr(checkpoint.walk_n) + ":" + LARGEtostr(checkpoint.walk_x) + ":" + LARGEtostr(checkpoint.walk_y) + ":" + LARGEtostr(checkpoint.walk_c);
+
+	return primes + "|" + cofactors + "|" + walk;
+}
+
+/**********************************************************************************************
+ * parseCheckpointFields - the reverse of buildCheckpointFields
+ **********************************************************************************************/
+FactorCheckpoint Slave::parseCheckpointFields(const std::string &primes, const std::string &cofactors, const std::string &walk) {
+	FactorCheckpoint checkpoint;
+	std::vector<std::string> values;
+
+	if (!primes.empty()) {
+		boost::algorithm::split(values, primes, boost::is_any_of(","));
+		for (auto &value : values)
+			checkpoint.primes.push_back(strtoLARGE(value));
+	}
+
+	if (!cofactors.empty()) {
+		boost::algorithm::split(values, cofactors, boost::is_any_of(","));
+		for (auto &value : values)
+			checkpoint.cofactors.push_back(strtoLARGE(value));
+	}
+
+	if (!walk.empty()) {
+		boost::algorithm::split(values, walk, boost::is_any_of(":"));
+		if (values.size() == 4) {
+			checkpoint.walk_n = strtoLARGE(values[0]);
+			checkpoint.walk_x = strtoLARGE(values[1]);
+			checkpoint.walk_y = strtoLARGE(values[2]);
+			checkpoint.walk_c = strtoLARGE(values[3]);
+		}
+	}
+
+	return checkpoint;
+}
+
+/**********************************************************************************************
+ * startMetrics - serves the metrics registry over HTTP on ip_addr:port, with the fraction of
+ *                its workers' time this slave node has spent factoring and its rho iterations per second
+ *                since the last scrape added
+ *
+ *    Returns: false if the port can't be bound
+ **********************************************************************************************/
+bool Slave::startMetrics(const char *ip_addr, unsigned short port) {
+	auto lastScrape = std::make_shared<std::pair<int64_t, uint64_t>>(steadyNs(), 0);
+	Metrics::get().addCollector([this, lastScrape](std::string &out) {
+		int64_t now = steadyNs();
+		double busy = pool.busyNs();
+		double up = (double) (now - slave_started) * pool.size();
+
+		uint64_t iterations = rhoIterations.value();
+		double interval = (now - lastScrape->first) / 1e9;
+		double rate = interval > 0 ? (iterations - lastScrape->second) / interval : 0;
+		*lastScrape = std::make_pair(now, iterations);
+
+		Metrics::appendHelp(out, "slave_busy_ratio", "fraction of the time since starting spent factoring");
+		Metrics::appendLine(out, "slave_busy_ratio", up > 0 ? busy / up : 0);
+		Metrics::appendHelp(out, "slave_rho_iterations_per_second", "Pollard's rho iterations per second since the last scrape");
+		Metrics::appendLine(out, "slave_rho_iterations_per_second", rate);
+	});
+	return Metrics::get().serve(ip_addr, port);
+}
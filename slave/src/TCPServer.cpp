@@ -20,19 +20,14 @@ TCPServer::~TCPServer() {
 }
 
 /*
- * Wrapper functions for logging. They use a lock to ensure threads do not attempt to write/read from
- * the log file at the same time.
+ * Wrapper functions for logging. Logger is thread safe, so threads can call these directly.
  */
 void TCPServer::log(const char *msg) {
-	m1.lock();
 	logger.log(msg);
-	m1.unlock();
 }
 
 void TCPServer::log(std::string msg) {
-	m1.lock();
 	logger.log(msg);
-	m1.unlock();
 }
 
 /**********************************************************************************************
@@ -0,0 +1,108 @@
+#include "Trace.h"
+#include <iostream>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * The one trace for this process.
+ */
+Trace& Trace::get() {
+	static Trace trace;
+	return trace;
+}
+
+/*
+ * Nanoseconds on the monotonic clock.
+ */
+uint64_t Trace::nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Starts tracing to fileName, which is created or truncated. Call once, before the threads that
+ * record events are started.
+ */
+void Trace::open(const std::string& fileName, TraceComponent component) {
+	traceFd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (traceFd == -1) {
+		std::cerr << "Failed to open trace file " << fileName << ": " << strerror(errno) << "\n";
+		return;
+	}
+
+	this->component = component;
+	buffer.reserve(4096);
+	running = true;
+	writer = std::thread(&Trace::writerThread, this);
+	isOpen = true;
+}
+
+Trace::~Trace() {
+	if (!running)
+		return;
+	running = false;
+	writer.join();
+	flush();
+	close(traceFd);
+}
+
+/*
+ * Records that event happened now. Does nothing unless the trace is open.
+ */
+void Trace::record(TraceEvent event, int32_t clientId, int32_t requestId, uint64_t seed, int32_t arg) {
+	if (!isOpen)
+		return;
+
+	TraceRecord rec;
+	rec.timeNs = nowNs();
+	rec.seed = seed;
+	rec.clientId = clientId;
+	rec.requestId = requestId;
+	rec.event = event;
+	rec.component = component;
+	rec.arg = arg;
+
+	std::lock_guard<std::mutex> lock(bufferMutex);
+	buffer.push_back(rec);
+}
+
+/*
+ * Writes out everything recorded so far.
+ */
+void Trace::flush() {
+	std::lock_guard<std::mutex> writeLock(writeMutex);
+
+	std::vector<TraceRecord> records;
+	records.reserve(4096);
+	{
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		records.swap(buffer);
+	}
+	if (records.empty())
+		return;
+
+	const char* data = (const char*) records.data();
+	size_t len = records.size() * sizeof(TraceRecord), written = 0;
+	while (written < len) {
+		ssize_t n = write(traceFd, data + written, len - written);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			std::cerr << "Failed to write to trace file!\n";
+			return;
+		}
+		written += n;
+	}
+}
+
+void Trace::writerThread() {
+	while (running) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(flushIntervalMs));
+		flush();
+	}
+}
@@ -0,0 +1,167 @@
+#include "WorkerPool.h"
+#include "Metrics.h"
+#include <chrono>
+
+static Counter &jobsStarted = Metrics::get().counter("slave_jobs_started_total", "jobs received from the coordinator");
+static Counter &jobsCompleted = Metrics::get().counter("slave_jobs_completed_total", "jobs factored and answered");
+static Counter &jobsCancelled = Metrics::get().counter("slave_jobs_cancelled_total", "jobs cancelled by the coordinator before they finished");
+static Counter &jobsOutOfBudget = Metrics::get().counter("slave_jobs_out_of_budget_total", "jobs answered with a partial result because their time or iteration budget ran out");
+static Histogram &jobDuration = Metrics::get().histogram("slave_job_duration_us", "time from a job arriving to its answer being queued");
+static Histogram &cancelLatency = Metrics::get().histogram("slave_cancel_latency_us", "time from a running job being cancelled to its worker being free again");
+
+static int64_t steadyNs() {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**********************************************************************************************
+ * WorkerPool (constructor) - starts the worker threads
+ *
+ *    Params:  workers - how many jobs can run at once
+ *             policy - which methods to factor with; the pool keeps its own copy
+ *             onDone - called on the worker's thread whenever a job ends
+ **********************************************************************************************/
+
+WorkerPool::WorkerPool(unsigned int workers, const FactorPolicy &policy, DoneHandler onDone):policy(policy),onDone(onDone) {
+   if (workers == 0)
+      workers = 1;
+   for (unsigned int i = 0; i < workers; i++) {
+      this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+      this->workers.back()->context.setPolicy(&this->policy);
+   }
+   for (auto &worker : this->workers)
+      worker->thread = std::thread(&WorkerPool::workerThread, this, worker.get());
+}
+
+/**********************************************************************************************
+ * WorkerPool (destructor) - cancels whatever is running, drops what is queued and waits for
+ *                           the workers to exit
+ **********************************************************************************************/
+
+WorkerPool::~WorkerPool() {
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+      queue.clear();
+      for (auto &worker : workers)
+         if (worker->jobId != 0)
+            worker->context.cancel_op();
+   }
+   jobReady.notify_all();
+   for (auto &worker : workers)
+      worker->thread.join();
+}
+
+void WorkerPool::submit(const FactorJob &job) {
+   jobsStarted.add();
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      queue.push_back(job);
+      queue.back().queuedNs = steadyNs();
+   }
+   jobReady.notify_one();
+}
+
+bool WorkerPool::cancel(unsigned long jobId) {
+   std::unique_lock<std::mutex> lock(mtx);
+   for (auto &worker : workers) {
+      if (worker->jobId == jobId) {
+         worker->cancelled = true;
+         worker->cancelledNs = steadyNs();
+         worker->context.cancel_op();
+         return true;
+      }
+   }
+
+   // not started yet, so it ends here
+   for (auto job = queue.begin(); job != queue.end(); job++) {
+      if (job->id == jobId) {
+         FactorJob cancelledJob = *job;
+         queue.erase(job);
+         lock.unlock();
+
+         jobsCancelled.add();
+         FactorResult none;
+         onDone(cancelledJob, none, true);
+         return true;
+      }
+   }
+   return false;
+}
+
+bool WorkerPool::getCheckpoint(unsigned long jobId, FactorCheckpoint &checkpoint) {
+   std::lock_guard<std::mutex> lock(mtx);
+   for (auto &worker : workers) {
+      if (worker->jobId == jobId) {
+         checkpoint = worker->context.getCheckpoint();
+         return true;
+      }
+   }
+   return false;
+}
+
+int64_t WorkerPool::busyNs() {
+   int64_t now = steadyNs();
+   int64_t busy = finishedNs;
+
+   std::lock_guard<std::mutex> lock(mtx);
+   for (auto &worker : workers)
+      if (worker->jobId != 0)
+         busy += now - worker->startedNs;
+   return busy;
+}
+
+/**********************************************************************************************
+ * workerThread - takes jobs off the queue and factors them, one at a time, until the pool is
+ *                destroyed. The worker's context is reset for each job rather than rebuilt.
+ **********************************************************************************************/
+
+void WorkerPool::workerThread(Worker *worker) {
+   std::unique_lock<std::mutex> lock(mtx);
+   while (true) {
+      jobReady.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (stopping)
+         return;
+
+      FactorJob job = queue.front();
+      queue.pop_front();
+
+      // set up under the lock, so a cancel can't land between the job starting and its context
+      // being ready for it
+      worker->jobId = job.id;
+      worker->cancelled = false;
+      worker->startedNs = steadyNs();
+      worker->context.reset(job.number);
+      if (job.seed != 0)
+         worker->context.setSeed(job.seed);
+      if (job.resume)
+         worker->context.resumeFrom(job.checkpoint);
+      worker->context.setBudget(job.budgetMs != 0 ? job.queuedNs + (int64_t) job.budgetMs * 1000000 : 0, job.budgetIterations);
+      lock.unlock();
+
+      FactorResult result;
+      worker->context.PolRho(result);
+
+      lock.lock();
+      bool cancelled = worker->cancelled;
+      worker->jobId = 0;
+      int64_t now = steadyNs();
+      finishedNs += now - worker->startedNs;
+      int64_t cancelledNs = worker->cancelledNs;
+      lock.unlock();
+
+      if (cancelled) {
+         result = FactorResult();
+         jobsCancelled.add();
+         cancelLatency.record((now - cancelledNs) / 1000);
+      } else {
+         if (result.unfactored.empty())
+            jobsCompleted.add();
+         else
+            jobsOutOfBudget.add();
+         jobDuration.record((now - job.queuedNs) / 1000);
+      }
+      onDone(job, result, cancelled);
+
+      lock.lock();
+   }
+}
@@ -11,12 +11,18 @@
 #include <getopt.h>
 #include "TCPClient.h"
 #include "exceptions.h"
+#include "Trace.h"
 
 using namespace std; 
 
 void displayHelp(const char *execname) {
    std::cout << execname << " -a <ip_addr> -p <port>" << std::endl;
    std::cout <<  "Optionally, add -s to make this a slave node client" << std::endl;
+   std::cout <<  "Optionally, add -t <ms> to set how long to wait for a server heartbeat (default 8000)" << std::endl;
+   std::cout <<  "Optionally, add -T <trace_file> to record a binary event trace of every job (see tracemerge)" << std::endl;
+   std::cout <<  "Optionally, add -j <jobs> to set how many jobs a slave node runs at once (default: one per core)" << std::endl;
+   std::cout <<  "Optionally, add -P <policy_file> to choose the factoring methods a slave node uses by number size (see README)" << std::endl;
+   std::cout <<  "Optionally, add -M <port> to serve slave node metrics over HTTP on 127.0.0.1 (e.g. curl http://127.0.0.1:<port>/metrics)" << std::endl;
 }
 
 // global default values
@@ -41,7 +47,13 @@ int main(int argc, char *argv[]) {
    int c = 0;
    long portval;
    bool slave = false;
-   while ((c = getopt(argc, argv, "p:a:s")) != -1) {
+   long heartbeat_timeout = 8000;
+   std::string trace_file;
+   long metrics_port = 0;
+   long max_jobs = 0;
+   FactorPolicy policy;
+   std::string policy_error;
+   while ((c = getopt(argc, argv, "p:a:st:T:M:j:P:")) != -1) {
       switch (c)
       {
       case 'p':
@@ -59,6 +71,36 @@ int main(int argc, char *argv[]) {
       case 's':
          slave = true;
          break;
+      case 't':
+         heartbeat_timeout = strtol(optarg, NULL, 10);
+         if (heartbeat_timeout < 1) {
+            std::cout << "Invalid heartbeat timeout. Value must be a positive number of milliseconds\n";
+            exit(0);
+         }
+         break;
+      case 'T':
+         trace_file = optarg;
+         break;
+      case 'j':
+         max_jobs = strtol(optarg, NULL, 10);
+         if (max_jobs < 1) {
+            std::cout << "Invalid job count. Value must be a positive number\n";
+            exit(0);
+         }
+         break;
+      case 'P':
+         if (!policy.load(optarg, policy_error)) {
+            std::cout << "Invalid factoring policy: " << policy_error << "\n";
+            exit(0);
+         }
+         break;
+      case 'M':
+         metrics_port = strtol(optarg, NULL, 10);
+         if ((metrics_port < 1) || (metrics_port > 65535)) {
+            std::cout << "Invalid metrics port. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         break;
       default:
          break;
       }
@@ -67,11 +109,17 @@ int main(int argc, char *argv[]) {
    // Try to set up the server for listening
    TCPClient* client;
    if(slave){
-      client = new Slave();
+      std::cout << "Factoring policy: " << policy.describe() << std::endl;
+      client = new Slave((unsigned int) max_jobs, policy);
    } else
    {
       client = new TCPClient();
    }
+   client->setHeartbeatTimeout(heartbeat_timeout);
+   if (trace_file.length() > 0)
+      Trace::get().open(trace_file, tc_slave);
+   if (slave && metrics_port > 0)
+      ((Slave *) client)->startMetrics("127.0.0.1", (unsigned short) metrics_port);
    
    try {
       cout << "Connecting to " << ip_addr << " port " << port << endl;
@@ -1,14 +1,24 @@
 # Author: Brian Curran
 # Date: 3/17/20
-# Description: Run this script to start the main server and coordinator
+# Description: Run this script to start the main server and coordinator(s)
 #              To execute, run following command:
 #              user$ bash start_servers.sh 
+#              NUM_COORDINATORS coordinators are started on ports 9999, 10000, ... and the main
+#              server shards the numbers across them
 
-# start coordinator
-cd coordinator/src && ./coordinator > coord_out.txt 2>&1 &
+NUM_COORDINATORS=1
+COORDINATOR_PORT=9999
+
+# start coordinator(s), each with its own output and log file
+COORDINATORS=""
+for i in $(eval echo {0..$((NUM_COORDINATORS - 1))})
+do
+	port=$((COORDINATOR_PORT + i))
+	cd coordinator/src && ./coordinator -p $port > coord_out_$port.txt 2>&1 &
+	COORDINATORS="$COORDINATORS${COORDINATORS:+,}127.0.0.1:$port"
+done
 
 sleep 2
 
 # start main server
-cd main_server/src && ./mainserver > main_server_out.txt 2>&1 &
-
+cd main_server/src && ./mainserver -c $COORDINATORS > main_server_out.txt 2>&1 &
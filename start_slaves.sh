@@ -2,10 +2,15 @@
 # Date: 3/17/20
 # Description: This script starts NUM_SLAVES slave nodes. To run this script, run the following command:
 #              curran$ bash start_slaves.sh
+#              The slave nodes are spread evenly across the NUM_COORDINATORS coordinators started by
+#              start_servers.sh (keep the two values the same)
 
 NUM_SLAVES=10
+NUM_COORDINATORS=1
+COORDINATOR_PORT=9999
 
 for i in $(eval echo {1..$NUM_SLAVES})
 do
-	cd slave/src/ && ./slave -s -a 127.0.0.1 -p 9999 >> slave_out.txt 2>&1 &
+	port=$((COORDINATOR_PORT + i % NUM_COORDINATORS))
+	cd slave/src/ && ./slave -s -a 127.0.0.1 -p $port >> slave_out.txt 2>&1 &
 done